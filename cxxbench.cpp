@@ -0,0 +1,186 @@
+/* porter-cxxbench: what the C++ layer costs over calling the stemmer by
+ * hand.
+ *
+ * The text on standard input is held in memory and run through three ways
+ * of stemming its alphabetic runs and keeping the stems of three letters or
+ * more:
+ *
+ *   loop        a hand-written scan copying each word and calling
+ *               PORTER_Stem()
+ *   ranges      porter::views::tokens | porter::views::stem |
+ *               std::views::filter
+ *   generator   porter::stems() over the text cut into chunks
+ *
+ * Each is run a number of times (-r) and the best time is reported, in
+ * nanoseconds per word, with the count and total length of the stems kept
+ * (which should agree, but for the generator skipping words longer than
+ * porter::max_word).
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ranges>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+#include "porter.hpp"
+
+struct Result
+{
+    std::size_t words = 0;
+    std::size_t kept = 0;
+    std::size_t bytes = 0;
+};
+
+static bool alpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static Result byLoop(std::string_view text)
+{
+    Result r;
+    char buf[porter::max_word + 1];
+    std::size_t i = 0;
+    std::size_t start;
+    std::size_t len;
+
+    while (i < text.size())
+    {
+        while (i < text.size() && !alpha(text[i])) i++;
+        start = i;
+        while (i < text.size() && alpha(text[i])) i++;
+        if (i == start) break;
+
+        r.words++;
+        len = i - start;
+        if (len <= porter::max_word)
+        {
+            std::memcpy(buf, text.data() + start, len);
+            buf[len] = '\0';
+            PORTER_Stem(buf);
+            len = std::strlen(buf);
+        }
+
+        if (len >= 3)
+        {
+            r.kept++;
+            r.bytes += len;
+        }
+    }
+
+    return r;
+}
+
+static Result byRanges(std::string_view text)
+{
+    Result r;
+    auto longer = [&r](std::string_view s)
+    {
+        r.words++;
+        return s.size() >= 3;
+    };
+
+    for (std::string_view s : porter::views::tokens(text) |
+                              porter::views::stem |
+                              std::views::filter(longer))
+    {
+        r.kept++;
+        r.bytes += s.size();
+    }
+
+    return r;
+}
+
+static Result byGenerator(std::string_view text, std::size_t chunk)
+{
+    Result r;
+    auto chunks = std::views::iota(std::size_t(0),
+                                   (text.size() + chunk - 1) / chunk) |
+                  std::views::transform([=](std::size_t i)
+                  {
+                      return text.substr(i * chunk, chunk);
+                  });
+
+    for (std::string_view s : porter::stems(chunks))
+    {
+        r.words++;
+        if (s.size() >= 3)
+        {
+            r.kept++;
+            r.bytes += s.size();
+        }
+    }
+
+    return r;
+}
+
+template <class F>
+static void bench(const char *name, int reps, F run)
+{
+    Result r;
+    double best = 0.0;
+    double ns;
+    int i;
+
+    for (i = 0; i < reps; i++)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        r = run();
+        auto t1 = std::chrono::steady_clock::now();
+
+        ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        if (i == 0 || ns < best) best = ns;
+    }
+
+    std::printf("%-10s %10zu words %10zu kept %12zu bytes %8.1f ns/word\n",
+                name, r.words, r.kept, r.bytes,
+                r.words ? best / r.words : 0.0);
+    return;
+}
+
+static void usage(const char *prog)
+{
+    std::fprintf(stderr, "usage: %s [-r reps] [-c chunk] < text\n", prog);
+    std::exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    std::string text;
+    char buf[65536];
+    std::size_t n;
+    std::size_t chunk = 4096;
+    int reps = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:c:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                reps = std::atoi(optarg);
+                break;
+            case 'c':
+                chunk = std::strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (reps < 1 || chunk < 1) usage(argv[0]);
+
+    while ((n = std::fread(buf, 1, sizeof(buf), stdin)) > 0)
+        text.append(buf, n);
+
+    bench("loop", reps, [&] { return byLoop(text); });
+    bench("ranges", reps, [&] { return byRanges(text); });
+    bench("generator", reps, [&] { return byGenerator(text, chunk); });
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+/* porter-ftsbench: bulk-insert throughput of FTS5 tables by tokenizer.
+ *
+ * The documents (one per line) on standard input are inserted, in one
+ * transaction, into an in-memory FTS5 table for each tokenizer in turn:
+ * FTS5's own "porter" and this library's "stemmer" (loaded from
+ * porterfts.so), both over unicode61, and unicode61 alone, which stems
+ * nothing and so shows what tokenizing and indexing cost without stemming.
+ * Each is run a number of times (-r) and the best time is reported, with
+ * the number of distinct terms indexed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+typedef struct
+{
+    char *text;
+    size_t *start;
+    size_t *len;
+    size_t n;
+} BENCH_Docs;
+
+static const char *BENCH_tokenizers[] = { "porter", "stemmer", "unicode61" };
+
+#define BENCH_NTOKENIZERS \
+    (sizeof(BENCH_tokenizers) / sizeof(BENCH_tokenizers[0]))
+
+static double BENCH_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int BENCH_read(FILE *fp, BENCH_Docs *docs)
+{
+    size_t size;
+    size_t used;
+    size_t got;
+    size_t i;
+    size_t n;
+    char *nl;
+
+    size = 1 << 20;
+    used = 0;
+    docs->text = malloc(size);
+    if (docs->text == NULL) return -1;
+
+    while ((got = fread(docs->text + used, 1, size - used, fp)) > 0)
+    {
+        used += got;
+        if (used < size) continue;
+
+        size *= 2;
+        docs->text = realloc(docs->text, size);
+        if (docs->text == NULL) return -1;
+    }
+
+    for (n = 0, i = 0; i < used; i++) n += (docs->text[i] == '\n');
+
+    docs->start = malloc((n + 1) * sizeof(*docs->start));
+    docs->len = malloc((n + 1) * sizeof(*docs->len));
+    if (docs->start == NULL || docs->len == NULL) return -1;
+
+    docs->n = 0;
+    for (i = 0; i < used; i += docs->len[docs->n++] + 1)
+    {
+        nl = memchr(docs->text + i, '\n', used - i);
+        docs->start[docs->n] = i;
+        docs->len[docs->n] = (nl != NULL) ? (size_t)(nl - docs->text) - i
+                                          : used - i;
+    }
+
+    return 0;
+}
+
+/* Insert every document into a new table using the tokenizer, returning
+ * the time taken (or a negative number on error). */
+static double BENCH_insert(sqlite3 *db, const BENCH_Docs *docs,
+                           const char *tokenizer, long *terms)
+{
+    sqlite3_stmt *stmt;
+    char sql[256];
+    double t0;
+    double t;
+    size_t i;
+
+    sqlite3_exec(db, "DROP TABLE IF EXISTS v; DROP TABLE IF EXISTS t",
+                 NULL, NULL, NULL);
+
+    snprintf(sql, sizeof(sql),
+             "CREATE VIRTUAL TABLE t USING fts5(x, tokenize='%s')",
+             tokenizer);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) return -1.0;
+
+    if (sqlite3_prepare_v2(db, "INSERT INTO t(x) VALUES (?1)", -1, &stmt,
+                           NULL) != SQLITE_OK)
+        return -1.0;
+
+    t0 = BENCH_now();
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+
+    for (i = 0; i < docs->n; i++)
+    {
+        sqlite3_bind_text(stmt, 1, docs->text + docs->start[i],
+                          docs->len[i], SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) break;
+        sqlite3_reset(stmt);
+    }
+
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    t = BENCH_now() - t0;
+    sqlite3_finalize(stmt);
+
+    if (i < docs->n) return -1.0;
+
+    *terms = 0;
+    sqlite3_exec(db, "CREATE VIRTUAL TABLE v USING fts5vocab(t, 'row')",
+                 NULL, NULL, NULL);
+    if (sqlite3_prepare_v2(db, "SELECT count(*) FROM v", -1, &stmt, NULL)
+        == SQLITE_OK)
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            *terms = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+
+    return t;
+}
+
+static void BENCH_usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-r reps] [-x extension] < docs\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    BENCH_Docs docs;
+    sqlite3 *db;
+    const char *ext = "./porterfts";
+    char *err;
+    double best;
+    double t;
+    long terms;
+    size_t k;
+    int reps = 3;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "r:x:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 'x':
+                ext = optarg;
+                break;
+            default:
+                BENCH_usage(argv[0]);
+        }
+    }
+
+    if (reps < 1) BENCH_usage(argv[0]);
+
+    if (BENCH_read(stdin, &docs) != 0)
+    {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], sqlite3_errmsg(db));
+        return 1;
+    }
+
+    sqlite3_enable_load_extension(db, 1);
+    if (sqlite3_load_extension(db, ext, NULL, &err) != SQLITE_OK)
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], err);
+        sqlite3_free(err);
+        return 1;
+    }
+
+    for (k = 0; k < BENCH_NTOKENIZERS; k++)
+    {
+        best = 0.0;
+        terms = 0;
+
+        for (i = 0; i < reps; i++)
+        {
+            t = BENCH_insert(db, &docs, BENCH_tokenizers[k], &terms);
+            if (t < 0.0)
+            {
+                fprintf(stderr, "%s: %s: %s\n", argv[0],
+                        BENCH_tokenizers[k], sqlite3_errmsg(db));
+                return 1;
+            }
+
+            if (i == 0 || t < best) best = t;
+        }
+
+        printf("%-10s %8zu docs %8.3f s %10.0f docs/s %8ld terms\n",
+               BENCH_tokenizers[k], docs.n, best, docs.n / best, terms);
+    }
+
+    sqlite3_close(db);
+    free(docs.text);
+    free(docs.start);
+    free(docs.len);
+
+    return 0;
+}
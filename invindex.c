@@ -0,0 +1,591 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "porter.h"
+
+/* An inverted index maps each stem to the documents containing it.  On
+ * disk (and in memory, once mapped) it is laid out as:
+ *
+ *   header      PORTER_InvHeader
+ *   terms       nterms + 1 entries of { name, postings, df }, sorted by
+ *               name; the postings of term i are the bytes from
+ *               terms[i].postings to terms[i + 1].postings
+ *   postings    for each term, its document numbers in increasing order,
+ *               each stored as a varint of the gap from the one before
+ *   pool        NUL-terminated stems
+ *
+ * All offsets are relative to the start of the file.
+ *
+ * The documents are split into contiguous ranges, one per thread, and each
+ * thread builds the (already compressed) postings for its own range in a
+ * hash table keyed by stem.  Since the ranges are in order, merging is a
+ * matter of sorting all of the partial lists by stem and concatenating
+ * each stem's lists, re-encoding only the first gap of each.
+ */
+
+#define PORTER_INVMAGIC  "PORTINV1"
+
+typedef struct
+{
+    char magic[8];
+    uint64_t ndocs;
+    uint64_t nterms;
+    uint64_t terms;      /* file offset of the term table */
+    uint64_t postings;   /* file offset of the postings */
+    uint64_t pool;       /* file offset of the string pool */
+    uint64_t poolsize;
+} PORTER_InvHeader;
+
+typedef struct
+{
+    uint64_t name;       /* file offset of the stem's string */
+    uint64_t postings;   /* file offset of the stem's postings */
+    uint64_t df;         /* the number of documents containing the stem */
+} PORTER_InvTerm;
+
+struct PORTER_InvIndex
+{
+    const uint8_t *base;
+    size_t size;
+    const PORTER_InvHeader *hdr;
+    const PORTER_InvTerm *terms;
+};
+
+/* A stem's postings within one thread's range of documents. */
+typedef struct
+{
+    char stem[PORTER_MAXWORD + 1];
+    uint64_t first;      /* the first document */
+    uint64_t last;       /* the last document */
+    uint64_t df;
+    uint8_t *gaps;       /* varint gaps of the documents after the first */
+    uint32_t len;
+    uint32_t cap;
+} PORTER_InvList;
+
+typedef struct
+{
+    const char *const *docs;
+    const size_t *lens;
+    uint64_t base;       /* the number of the first document */
+    size_t n;
+    const PORTER_Stopwords *stop;
+    PORTER_InvList *lists;
+    size_t nlists;
+    size_t cap;
+    uint32_t *table;     /* list index + 1, or 0 if empty */
+    size_t mask;
+    int failed;
+} PORTER_InvRun;
+
+static size_t PORTER_putVarint(uint8_t *p, uint64_t v)
+{
+    size_t n;
+
+    for (n = 0; v >= 0x80; n++, v >>= 7) p[n] = (uint8_t)(v | 0x80);
+    p[n++] = (uint8_t)v;
+
+    return n;
+}
+
+static size_t PORTER_varintLen(uint64_t v)
+{
+    size_t n;
+
+    for (n = 1; v >= 0x80; n++) v >>= 7;
+    return n;
+}
+
+static uint32_t PORTER_hashStem(const char *stem)
+{
+    uint32_t h;
+
+    for (h = 2166136261u; *stem != '\0'; stem++)
+        h = (h ^ (uint8_t)*stem) * 16777619u;
+
+    return h;
+}
+
+static int PORTER_growTable(PORTER_InvRun *run)
+{
+    uint32_t *table;
+    size_t mask;
+    size_t i;
+    size_t h;
+
+    mask = (run->mask == 0) ? 4095 : run->mask * 2 + 1;
+    table = calloc(mask + 1, sizeof(*table));
+    if (table == NULL) return -1;
+
+    for (i = 0; i < run->nlists; i++)
+    {
+        h = PORTER_hashStem(run->lists[i].stem) & mask;
+        while (table[h] != 0) h = (h + 1) & mask;
+        table[h] = i + 1;
+    }
+
+    free(run->table);
+    run->table = table;
+    run->mask = mask;
+
+    return 0;
+}
+
+/* Find (or add) the list for a stem. */
+static PORTER_InvList *PORTER_findList(PORTER_InvRun *run, const char *stem,
+                                       size_t len)
+{
+    PORTER_InvList *l;
+    size_t h;
+    void *p;
+
+    if (2 * (run->nlists + 1) > run->mask && PORTER_growTable(run) != 0)
+        return NULL;
+
+    for (h = PORTER_hashStem(stem) & run->mask; run->table[h] != 0;
+         h = (h + 1) & run->mask)
+    {
+        l = &run->lists[run->table[h] - 1];
+        if (memcmp(l->stem, stem, len + 1) == 0) return l;
+    }
+
+    if (run->nlists == run->cap)
+    {
+        run->cap = (run->cap == 0) ? 4096 : run->cap * 2;
+        p = realloc(run->lists, run->cap * sizeof(*run->lists));
+        if (p == NULL) return NULL;
+        run->lists = p;
+    }
+
+    l = &run->lists[run->nlists];
+    memset(l, 0x00, sizeof(*l));
+    memcpy(l->stem, stem, len + 1);
+    run->table[h] = ++run->nlists;
+
+    return l;
+}
+
+static int PORTER_addPosting(PORTER_InvRun *run, const char *stem,
+                             uint64_t doc)
+{
+    PORTER_InvList *l;
+    uint8_t *p;
+    uint32_t cap;
+
+    l = PORTER_findList(run, stem, strlen(stem));
+    if (l == NULL) return -1;
+
+    if (l->df == 0)
+    {
+        l->first = l->last = doc;
+        l->df = 1;
+        return 0;
+    }
+
+    if (l->last == doc) return 0;
+
+    if (l->len + 10 > l->cap)
+    {
+        cap = (l->cap == 0) ? 16 : l->cap * 2;
+        p = realloc(l->gaps, cap);
+        if (p == NULL) return -1;
+        l->gaps = p;
+        l->cap = cap;
+    }
+
+    l->len += PORTER_putVarint(&l->gaps[l->len], doc - l->last);
+    l->last = doc;
+    l->df++;
+
+    return 0;
+}
+
+static void *PORTER_indexRun(void *arg)
+{
+    PORTER_InvRun *run = arg;
+    char word[PORTER_MAXWORD + 1];
+    const char *doc;
+    size_t len;
+    size_t i, j, start;
+
+    for (i = 0; i < run->n && !run->failed; i++)
+    {
+        doc = run->docs[i];
+        len = (run->lens != NULL) ? run->lens[i] : strlen(doc);
+
+        for (j = 0; j < len; )
+        {
+            if (!isalpha((unsigned char)doc[j]))
+            {
+                j++;
+                continue;
+            }
+
+            for (start = j; j < len && isalpha((unsigned char)doc[j]); j++)
+                ;
+
+            if (j - start > PORTER_MAXWORD) continue;
+
+            memcpy(word, &doc[start], j - start);
+            word[j - start] = '\0';
+
+            if (PORTER_StemStop(word, run->stop) != 0) continue;
+
+            if (PORTER_addPosting(run, word, run->base + i) != 0)
+            {
+                run->failed = 1;
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Order partial lists by stem, then by document range. */
+static int PORTER_cmpList(const void *a, const void *b)
+{
+    const PORTER_InvList *la = *(const PORTER_InvList *const *)a;
+    const PORTER_InvList *lb = *(const PORTER_InvList *const *)b;
+    int rc;
+
+    rc = strcmp(la->stem, lb->stem);
+    if (rc != 0) return rc;
+
+    return (la->first > lb->first) - (la->first < lb->first);
+}
+
+/* Write the merged index.  The term table and pool are built in a first
+ * pass over the sorted lists; the postings are streamed out in a second. */
+static int PORTER_writeInvIndex(const char *path, PORTER_InvList **lists,
+                                size_t nlists, uint64_t ndocs)
+{
+    PORTER_InvHeader hdr;
+    PORTER_InvTerm *terms;
+    char *pool;
+    uint8_t gap[10];
+    uint64_t size;
+    uint64_t prev;
+    size_t nterms;
+    size_t plen;
+    size_t i, j;
+    FILE *fp;
+    int rc;
+
+    /* every list could be a term of its own; the sentinel makes one more */
+    terms = malloc((nlists + 1) * sizeof(*terms));
+    pool = malloc(nlists * (PORTER_MAXWORD + 1) + 1);
+    if (terms == NULL || pool == NULL)
+    {
+        free(terms);
+        free(pool);
+        return -1;
+    }
+
+    nterms = 0;
+    plen = 0;
+    size = 0;
+    for (i = 0; i < nlists; i = j)
+    {
+        terms[nterms].name = plen;
+        terms[nterms].postings = size;
+        terms[nterms].df = 0;
+
+        prev = 0;
+        for (j = i; j < nlists && strcmp(lists[j]->stem,
+                                         lists[i]->stem) == 0; j++)
+        {
+            size += PORTER_varintLen(lists[j]->first - prev) + lists[j]->len;
+            terms[nterms].df += lists[j]->df;
+            prev = lists[j]->last;
+        }
+
+        memcpy(&pool[plen], lists[i]->stem, strlen(lists[i]->stem) + 1);
+        plen += strlen(lists[i]->stem) + 1;
+        nterms++;
+    }
+
+    terms[nterms].name = 0;
+    terms[nterms].postings = size;
+    terms[nterms].df = 0;
+
+    memset(&hdr, 0x00, sizeof(hdr));
+    memcpy(hdr.magic, PORTER_INVMAGIC, sizeof(hdr.magic));
+    hdr.ndocs = ndocs;
+    hdr.nterms = nterms;
+    hdr.terms = sizeof(hdr);
+    hdr.postings = hdr.terms + (nterms + 1) * sizeof(*terms);
+    hdr.pool = hdr.postings + size;
+    hdr.poolsize = plen;
+
+    /* make offsets relative to the file */
+    for (i = 0; i <= nterms; i++)
+    {
+        terms[i].name += hdr.pool;
+        terms[i].postings += hdr.postings;
+    }
+
+    rc = -1;
+    fp = fopen(path, "wb");
+    if (fp == NULL) goto done;
+
+    rc = 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(terms, sizeof(*terms), nterms + 1, fp) != nterms + 1)
+        rc = -1;
+
+    for (i = 0; i < nlists && rc == 0; i++)
+    {
+        prev = (i > 0 && strcmp(lists[i - 1]->stem, lists[i]->stem) == 0) ?
+               lists[i - 1]->last : 0;
+
+        if (fwrite(gap, 1, PORTER_putVarint(gap, lists[i]->first - prev),
+                   fp) == 0 ||
+            fwrite(lists[i]->gaps, 1, lists[i]->len, fp) != lists[i]->len)
+            rc = -1;
+    }
+
+    if (rc == 0 && fwrite(pool, 1, plen, fp) != plen) rc = -1;
+    if (fclose(fp) != 0) rc = -1;
+
+done:
+    free(terms);
+    free(pool);
+    return rc;
+}
+
+int PORTER_InvIndexBuild(const char *const *docs, const size_t *lens,
+                         size_t n, int nthreads,
+                         const PORTER_Stopwords *stop, const char *path)
+{
+    PORTER_InvRun *runs;
+    PORTER_InvList **lists;
+    pthread_t *tids;
+    size_t nlists;
+    size_t per;
+    size_t off;
+    size_t k;
+    int started;
+    int rc;
+    int i;
+
+    if (nthreads < 1) nthreads = 1;
+    if ((size_t)nthreads > n) nthreads = (n > 0) ? n : 1;
+
+    runs = calloc(nthreads, sizeof(*runs));
+    tids = calloc(nthreads, sizeof(*tids));
+    if (runs == NULL || tids == NULL)
+    {
+        free(runs);
+        free(tids);
+        return -1;
+    }
+
+    per = (n + nthreads - 1) / nthreads;
+    off = 0;
+    for (i = 0; i < nthreads; i++)
+    {
+        runs[i].docs = &docs[off];
+        runs[i].lens = (lens != NULL) ? &lens[off] : NULL;
+        runs[i].base = off;
+        runs[i].n = (n - off < per) ? n - off : per;
+        runs[i].stop = stop;
+        off += runs[i].n;
+    }
+
+    /* the calling thread takes the first run itself */
+    started = 1;
+    for (i = 1; i < nthreads; i++, started++)
+    {
+        if (pthread_create(&tids[i], NULL, PORTER_indexRun, &runs[i]) != 0)
+            break;
+    }
+
+    PORTER_indexRun(&runs[0]);
+    for (i = 1; i < started; i++) pthread_join(tids[i], NULL);
+
+    /* any run which couldn't be given a thread is done here */
+    for (i = started; i < nthreads; i++) PORTER_indexRun(&runs[i]);
+
+    rc = -1;
+    nlists = 0;
+    for (i = 0; i < nthreads; i++)
+    {
+        if (runs[i].failed) goto done;
+        nlists += runs[i].nlists;
+    }
+
+    lists = malloc((nlists + 1) * sizeof(*lists));
+    if (lists == NULL) goto done;
+
+    nlists = 0;
+    for (i = 0; i < nthreads; i++)
+    {
+        for (k = 0; k < runs[i].nlists; k++)
+            lists[nlists++] = &runs[i].lists[k];
+    }
+
+    qsort(lists, nlists, sizeof(*lists), PORTER_cmpList);
+    rc = PORTER_writeInvIndex(path, lists, nlists, n);
+    free(lists);
+
+done:
+    for (i = 0; i < nthreads; i++)
+    {
+        for (k = 0; k < runs[i].nlists; k++) free(runs[i].lists[k].gaps);
+        free(runs[i].lists);
+        free(runs[i].table);
+    }
+
+    free(runs);
+    free(tids);
+
+    return rc;
+}
+
+PORTER_InvIndex *PORTER_InvIndexOpen(const char *path)
+{
+    PORTER_InvIndex *ix;
+    const PORTER_InvHeader *hdr;
+    const PORTER_InvTerm *terms;
+    struct stat sb;
+    void *base;
+    uint64_t i;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(*hdr))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    /* check that the tables lie within the file before trusting them */
+    hdr = base;
+    if (memcmp(hdr->magic, PORTER_INVMAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->terms != sizeof(*hdr) ||
+        hdr->nterms >= ((uint64_t)sb.st_size - sizeof(*hdr)) /
+                       sizeof(PORTER_InvTerm) ||
+        hdr->postings != hdr->terms +
+                         (hdr->nterms + 1) * sizeof(PORTER_InvTerm) ||
+        hdr->pool < hdr->postings ||
+        hdr->pool + hdr->poolsize != (uint64_t)sb.st_size ||
+        (hdr->poolsize > 0 && ((const char *)base)[sb.st_size - 1] != '\0'))
+        goto fail;
+
+    terms = (const PORTER_InvTerm *)((const uint8_t *)base + hdr->terms);
+    for (i = 0; i < hdr->nterms; i++)
+    {
+        if (terms[i].name < hdr->pool ||
+            terms[i].name >= (uint64_t)sb.st_size ||
+            terms[i].postings > terms[i + 1].postings)
+            goto fail;
+    }
+
+    if (terms[0].postings != hdr->postings ||
+        terms[hdr->nterms].postings != hdr->pool)
+        goto fail;
+
+    ix = malloc(sizeof(*ix));
+    if (ix == NULL) goto fail;
+
+    ix->base = base;
+    ix->size = sb.st_size;
+    ix->hdr = hdr;
+    ix->terms = terms;
+
+    return ix;
+
+fail:
+    munmap(base, sb.st_size);
+    return NULL;
+}
+
+void PORTER_InvIndexClose(PORTER_InvIndex *ix)
+{
+    if (ix == NULL) return;
+
+    munmap((void *)ix->base, ix->size);
+    free(ix);
+
+    return;
+}
+
+size_t PORTER_InvIndexLookup(const PORTER_InvIndex *ix, const char *stem,
+                             size_t len, PORTER_Postings *it)
+{
+    const char *name;
+    size_t lo, hi, mid;
+    int rc;
+
+    memset(it, 0x00, sizeof(*it));
+
+    lo = 0;
+    hi = ix->hdr->nterms;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        name = (const char *)ix->base + ix->terms[mid].name;
+
+        /* compare as strcmp() would, without needing stem terminated */
+        rc = strncmp(name, stem, len);
+        if (rc == 0 && name[len] != '\0') rc = 1;
+
+        if (rc == 0)
+        {
+            it->p = ix->base + ix->terms[mid].postings;
+            it->end = ix->base + ix->terms[mid + 1].postings;
+            return ix->terms[mid].df;
+        }
+
+        if (rc < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return 0;
+}
+
+int PORTER_PostingsNext(PORTER_Postings *it, uint64_t *doc)
+{
+    uint64_t gap;
+    int shift;
+
+    if (it->p == it->end) return 0;
+
+    gap = 0;
+    for (shift = 0; it->p < it->end && shift < 64; shift += 7)
+    {
+        gap |= (uint64_t)(*it->p & 0x7F) << shift;
+        if ((*it->p++ & 0x80) == 0) break;
+    }
+
+    it->doc += gap;
+    *doc = it->doc;
+
+    return 1;
+}
+
+size_t PORTER_InvIndexDocs(const PORTER_InvIndex *ix)
+{
+    return ix->hdr->ndocs;
+}
+
+size_t PORTER_InvIndexTerms(const PORTER_InvIndex *ix)
+{
+    return ix->hdr->nterms;
+}
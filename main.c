@@ -3,36 +3,788 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "porter.h"
+#include "record.h"
+#include "source.h"
+#include "parallel.h"
+#include "pipeline.h"
+
+#define BLOCK_SIZE (1 << 20)
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-s | -S file] [-p | -C name | -L level] [-j threads]\n"
+            "              [-T k [-q]] [-i file]\n"
+            "       %s [-s | -S file] [-p | -C name | -L level] [-T k [-q]]\n"
+            "              word ...\n"
+            "       %s [-j threads] -R index < words\n"
+            "       %s -Q index [word ...]\n"
+            "       %s [-s | -S file] [-j threads] [-d delim] [-i file]\n"
+            "              -I index\n"
+            "       %s -P index [word ...]\n"
+            "       %s [-s | -S file] -F tsv|csv|jsonl [-f field] [-k key]\n"
+            "              [-t] [-C name | -L level] [-T k [-q]]\n"
+            "              [-j threads] [-i file]\n"
+            "\n"
+            "  -s        drop English stopwords rather than stemming them\n"
+            "  -S file   as -s, using the stopwords listed in file\n"
+            "  -p        words are sorted; measure each only from where it\n"
+            "            differs from the one before\n"
+            "  -F fmt    stem one field of each TSV, CSV or JSON-lines\n"
+            "            record of the input; other fields pass through\n"
+            "            unchanged\n"
+            "  -f field  the (one-based) column to stem (default 1)\n"
+            "  -k key    the top-level member to stem (jsonl)\n"
+            "  -t        stem every token within the field, rather than\n"
+            "            treating the field as a single word (stopwords are\n"
+            "            passed through unstemmed)\n"
+            "  -i file   read from file rather than stdin; input compressed\n"
+            "            with gzip or zstd is decompressed, in parallel\n"
+            "            where it is made up of several members or frames\n"
+            "  -j n      use n threads (default: one per CPU)\n"
+            "  -R index  build a reverse index, from each stem to the forms\n"
+            "            which produced it, of the words read from stdin\n"
+            "  -Q index  print the forms in a reverse index which share the\n"
+            "            stem of each word\n"
+            "  -I index  build an inverted index, from each stem to the\n"
+            "            documents containing it, of the documents read\n"
+            "            from the input (one per line), and report the\n"
+            "            throughput\n"
+            "  -d delim  documents are separated by delim rather than by\n"
+            "            newlines ('' for NUL)\n"
+            "  -P index  print the documents in an inverted index which\n"
+            "            contain the stem of each word\n"
+            "  -C name   look stems up in (and add them to) the stem cache\n"
+            "            in shared memory segment name, shared by every\n"
+            "            process using it, and report its hit rate\n"
+            "  -L level  stem lightly: 's' folds plurals only, '1' applies\n"
+            "            only Porter's step 1 (plurals, -ed, -ing), 'full'\n"
+            "            (the default) applies every step\n"
+            "  -T k      count the distinct stems (approximately, in fixed\n"
+            "            memory) and the k most frequent, and report them\n"
+            "            on stderr\n"
+            "  -q        with -T, report on stdout in place of the stems\n",
+            prog, prog, prog, prog, prog, prog, prog);
+    exit(1);
+}
+
+/* Read records from 'in' a block at a time, stemming each block of complete
+ * records as it is read.  A partial record at the end of a block is carried
+ * over to the next read.  If out is NULL, the stems are only counted. */
+static int stemRecords(const RECORD_Spec *spec, SOURCE_Input *in, FILE *out)
+{
+    char *buf;
+    char *p;
+    size_t cap;
+    size_t have;
+    size_t done;
+    ssize_t n;
+    RECORD_Buffer ob;
+
+    cap = BLOCK_SIZE;
+    buf = malloc(cap);
+    if (buf == NULL) return -1;
+
+    memset(&ob, 0x00, sizeof(ob));
+    ob.sketch = spec->sketch;
+    ob.discard = (out == NULL);
+    have = 0;
+
+    while ((n = SOURCE_Read(in, &buf[have], cap - have)) > 0)
+    {
+        have += n;
+
+        done = RECORD_Complete(spec, buf, have);
+        if (done == 0)
+        {
+            if (have < cap) continue;
+
+            /* a single record larger than the block; grow it */
+            p = realloc(buf, cap * 2);
+            if (p == NULL) break;
+            buf = p;
+            cap *= 2;
+            continue;
+        }
+
+        if (RECORD_StemBlock(spec, buf, done, &ob) != 0) break;
+        if (out != NULL) fwrite(ob.data, 1, ob.len, out);
+        ob.len = 0;
+
+        memmove(buf, &buf[done], have - done);
+        have -= done;
+    }
+
+    /* the final record may lack a newline */
+    if (n == 0 && have > 0 && RECORD_StemBlock(spec, buf, have, &ob) == 0)
+    {
+        if (out != NULL) fwrite(ob.data, 1, ob.len, out);
+        have = 0;
+    }
+
+    free(ob.data);
+    free(buf);
+
+    return (n == 0 && have == 0) ? 0 : -1;
+}
+
+/* Stem the input, splitting it between threads where it can be split. */
+static int stemInput(const RECORD_Spec *spec, const char *path,
+                     int nthreads, FILE *out)
+{
+    SOURCE_Input *in;
+    SOURCE_Unit *units;
+    size_t n;
+    int rc;
+
+    in = SOURCE_Open(path);
+    if (in == NULL) return -1;
+
+    /* a stream can't be split up front, but can still be pipelined;
+     * not a terminal, though, where each line wants its answer at once */
+    units = SOURCE_Units(in, BLOCK_SIZE, &n);
+    if (units != NULL) rc = PARALLEL_Stem(spec, in, units, n, nthreads, out);
+    else if (nthreads > 1 && !SOURCE_Interactive(in))
+        rc = PIPELINE_Stem(spec, in, nthreads, out);
+    else rc = stemRecords(spec, in, out);
+
+    free(units);
+    SOURCE_Close(in);
+
+    return rc;
+}
+
+/* Stem one word in the plain (one word per line) mode. */
+static int stemWord(char *str, const PORTER_Stopwords *stop,
+                    PORTER_Prefix *prev, PORTER_Cache *cache, int level)
+{
+    if (stop != NULL && PORTER_IsStopword(stop, str, strlen(str)))
+        return PORTER_STOPWORD;
+
+    if (level != PORTER_LEVEL_FULL) return PORTER_StemLevel(str, level);
+    if (prev != NULL) return PORTER_StemPrefix(str, prev);
+    return PORTER_StemCached(str, cache);
+}
+
+static void reportCache(PORTER_Cache *cache)
+{
+    PORTER_CacheCounts cc;
+    uint64_t total;
+
+    PORTER_CacheStats(cache, &cc);
+    total = cc.hits + cc.misses;
+
+    fprintf(stderr, "cache: %llu slots, %llu hits, %llu misses (%.1f%% hit), "
+            "%llu inserts, %llu evictions, %llu busy, %llu recovered\n",
+            (unsigned long long)cc.slots, (unsigned long long)cc.hits,
+            (unsigned long long)cc.misses,
+            total ? 100.0 * cc.hits / total : 0.0,
+            (unsigned long long)cc.inserts, (unsigned long long)cc.evictions,
+            (unsigned long long)cc.busy, (unsigned long long)cc.recovered);
+    return;
+}
+
+static void reportSketch(PORTER_Sketch *sketch, FILE *fp)
+{
+    PORTER_TopStem *top;
+    size_t n;
+    size_t i;
+
+    fprintf(fp, "%llu stems, about %llu distinct\n",
+            (unsigned long long)PORTER_SketchTotal(sketch),
+            (unsigned long long)PORTER_SketchDistinct(sketch));
+
+    top = malloc(PORTER_SketchCapacity(sketch) * sizeof(*top));
+    if (top == NULL) return;
+
+    n = PORTER_SketchTop(sketch, top, PORTER_SketchCapacity(sketch));
+    for (i = 0; i < n; i++)
+    {
+        fprintf(fp, "%llu\t%llu\t%s\n", (unsigned long long)top[i].count,
+                (unsigned long long)top[i].error, top[i].stem);
+    }
+
+    free(top);
+    return;
+}
+
+/* Read one word per line into a single arena, with a pointer to each. */
+static char **readWords(FILE *in, size_t *count, char **arena)
+{
+    char *buf;
+    char **words;
+    void *p;
+    size_t cap;
+    size_t have;
+    size_t n;
+    size_t i;
+
+    cap = BLOCK_SIZE;
+    buf = malloc(cap);
+    if (buf == NULL) return NULL;
+
+    have = 0;
+    while ((n = fread(&buf[have], 1, cap - have - 1, in)) > 0)
+    {
+        have += n;
+        if (have + 1 < cap) continue;
+
+        if ((p = realloc(buf, cap * 2)) == NULL) goto fail;
+        buf = p;
+        cap *= 2;
+    }
+
+    if (ferror(in)) goto fail;
+
+    buf[have] = '\0';
+    n = 0;
+    for (i = 0; i < have; i++)
+    {
+        if (buf[i] == '\n') n++;
+    }
+
+    words = malloc((n + 1) * sizeof(*words));
+    if (words == NULL) goto fail;
+
+    /* terminate each line in place */
+    n = 0;
+    i = 0;
+    while (i < have)
+    {
+        size_t end = i;
+
+        while (end < have && buf[end] != '\n') end++;
+        buf[end] = '\0';
+
+        if (end > i) words[n++] = &buf[i];
+        i = end + 1;
+    }
+
+    *count = n;
+    *arena = buf;
+    return words;
+
+fail:
+    free(buf);
+    return NULL;
+}
+
+static int buildRevIndex(const char *path, int nthreads)
+{
+    char **words;
+    char *arena;
+    size_t n;
+    int rc;
+
+    words = readWords(stdin, &n, &arena);
+    if (words == NULL) return -1;
+
+    rc = PORTER_RevIndexBuild((const char *const *)words, n, nthreads, path);
+
+    free(words);
+    free(arena);
+    return rc;
+}
+
+static void queryWord(const PORTER_RevIndex *ri, const char *word,
+                      int verbose)
+{
+    char str[128];
+    const uint64_t *forms;
+    size_t n;
+    size_t i;
+
+    if (verbose) fprintf(stdout, "%s ->", word);
+
+    snprintf(str, sizeof(str), "%s", word);
+    if (PORTER_Stem(str) == 0)
+    {
+        n = PORTER_RevIndexLookup(ri, str, strlen(str), &forms);
+        for (i = 0; i < n; i++)
+        {
+            fprintf(stdout, (verbose || i > 0) ? " %s" : "%s",
+                    PORTER_RevIndexForm(ri, forms[i]));
+        }
+    }
+
+    fprintf(stdout, "\n");
+    return;
+}
+
+static int queryRevIndex(const char *path, int argc, char **argv)
+{
+    PORTER_RevIndex *ri;
+    char str[128];
+    int i;
+
+    ri = PORTER_RevIndexOpen(path);
+    if (ri == NULL) return -1;
+
+    if (argc > 0)
+    {
+        for (i = 0; i < argc; i++) queryWord(ri, argv[i], 1);
+    }
+    else
+    {
+        while (fgets(str, sizeof(str), stdin))
+        {
+            str[strcspn(str, "\n")] = '\0';
+            queryWord(ri, str, 0);
+        }
+    }
+
+    PORTER_RevIndexClose(ri);
+    return 0;
+}
+
+/* Read a whole input, split into documents at each delim. */
+static const char **readDocs(const char *path, int delim, size_t *count,
+                             size_t **lens, char **arena)
+{
+    SOURCE_Input *in;
+    const char **docs;
+    const char *p;
+    const char *end;
+    RECORD_Buffer buf;
+    size_t n;
+    ssize_t got;
+
+    in = SOURCE_Open(path);
+    if (in == NULL) return NULL;
+
+    memset(&buf, 0x00, sizeof(buf));
+    do
+    {
+        if (RECORD_Reserve(&buf, BLOCK_SIZE) != 0)
+        {
+            got = -1;
+            break;
+        }
+
+        got = SOURCE_Read(in, &buf.data[buf.len], buf.cap - buf.len);
+        if (got > 0) buf.len += got;
+    } while (got > 0);
+
+    SOURCE_Close(in);
+    if (got < 0)
+    {
+        free(buf.data);
+        return NULL;
+    }
+
+    /* a final document need not be terminated */
+    n = 0;
+    end = buf.data + buf.len;
+    for (p = buf.data; p < end; p++)
+    {
+        if ((unsigned char)*p == delim) n++;
+    }
+    if (buf.len > 0 && (unsigned char)end[-1] != delim) n++;
+
+    docs = malloc((n + 1) * sizeof(*docs));
+    *lens = malloc((n + 1) * sizeof(**lens));
+    if (docs == NULL || *lens == NULL)
+    {
+        free(docs);
+        free(*lens);
+        free(buf.data);
+        return NULL;
+    }
+
+    n = 0;
+    for (p = buf.data; p < end; p++)
+    {
+        docs[n] = p;
+        while (p < end && (unsigned char)*p != delim) p++;
+        (*lens)[n] = p - docs[n];
+        n++;
+    }
+
+    *count = n;
+    *arena = buf.data;
+    return docs;
+}
+
+static double elapsed(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static int buildInvIndex(const char *path, const char *input, int delim,
+                         int nthreads, const PORTER_Stopwords *stop)
+{
+    const char **docs;
+    size_t *lens;
+    char *arena;
+    size_t n;
+    struct timespec t0;
+    double secs;
+    int rc;
+
+    docs = readDocs(input, delim, &n, &lens, &arena);
+    if (docs == NULL) return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc = PORTER_InvIndexBuild(docs, lens, n, nthreads, stop, path);
+    secs = elapsed(&t0);
+
+    if (rc == 0)
+    {
+        fprintf(stderr, "%zu documents, %d threads: %.3f s, "
+                "%.0f documents/s\n", n, nthreads, secs,
+                (secs > 0) ? n / secs : 0.0);
+    }
+
+    free(docs);
+    free(lens);
+    free(arena);
+    return rc;
+}
+
+static void queryPostings(const PORTER_InvIndex *ix, const char *word,
+                          int verbose)
+{
+    char str[128];
+    PORTER_Postings it;
+    uint64_t doc;
+    int first;
+
+    if (verbose) fprintf(stdout, "%s ->", word);
+
+    snprintf(str, sizeof(str), "%s", word);
+    if (PORTER_Stem(str) == 0 &&
+        PORTER_InvIndexLookup(ix, str, strlen(str), &it) > 0)
+    {
+        for (first = !verbose; PORTER_PostingsNext(&it, &doc); first = 0)
+            fprintf(stdout, first ? "%llu" : " %llu",
+                    (unsigned long long)doc);
+    }
+
+    fprintf(stdout, "\n");
+    return;
+}
+
+static int queryInvIndex(const char *path, int argc, char **argv)
+{
+    PORTER_InvIndex *ix;
+    char str[128];
+    int i;
+
+    ix = PORTER_InvIndexOpen(path);
+    if (ix == NULL) return -1;
+
+    if (argc > 0)
+    {
+        for (i = 0; i < argc; i++) queryPostings(ix, argv[i], 1);
+    }
+    else
+    {
+        while (fgets(str, sizeof(str), stdin))
+        {
+            str[strcspn(str, "\n")] = '\0';
+            queryPostings(ix, str, 0);
+        }
+    }
+
+    PORTER_InvIndexClose(ix);
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
     int i;
+    int rc;
+    int opt;
     char str[128];
+    int nthreads;
+    int sorted;
+    PORTER_Prefix prev;
+    const char *build;
+    const char *query;
+    const char *input;
+    const char *index;
+    const char *postings;
+    const char *cache;
+    int delim;
+    int top;
+    int quiet;
+    int stemmed;
+    FILE *out;
+    RECORD_Spec spec;
+    PORTER_Stopwords *stop;
+
+    memset(&spec, 0x00, sizeof(spec));
+    stop = NULL;
+    build = NULL;
+    query = NULL;
+    input = NULL;
+    index = NULL;
+    postings = NULL;
+    cache = NULL;
+    delim = '\n';
+    top = 0;
+    quiet = 0;
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    sorted = 0;
+    memset(&prev, 0x00, sizeof(prev));
 
-    if (argc > 1)
+    while ((opt = getopt(argc, argv,
+                         "F:f:k:tsS:pj:i:R:Q:I:P:d:C:L:T:q")) != -1)
     {
-        for (i = 1; i < argc; i++)  /* for each input word... */
+        switch (opt)
         {
-            strcpy(str, argv[i]);
+            case 'F':
+                if (strcmp(optarg, "tsv") == 0) spec.format = RECORD_TSV;
+                else if (strcmp(optarg, "csv") == 0) spec.format = RECORD_CSV;
+                else if (strcmp(optarg, "jsonl") == 0)
+                    spec.format = RECORD_JSONL;
+                else usage(argv[0]);
+                break;
+
+            case 'f':
+                spec.field = atoi(optarg) - 1;
+                if (spec.field < 0) usage(argv[0]);
+                if (spec.format == 0) spec.format = RECORD_TSV;
+                break;
+
+            case 'k':
+                spec.key = optarg;
+                spec.keylen = strlen(optarg);
+                if (spec.format == 0) spec.format = RECORD_JSONL;
+                break;
+
+            case 't':
+                spec.tokens = 1;
+                break;
+
+            case 's':
+                PORTER_StopwordsFree(stop);
+                stop = PORTER_StopwordsCreate(NULL, 0);
+                if (stop == NULL)
+                {
+                    fprintf(stderr, "%s: cannot build stopwords\n", argv[0]);
+                    return 1;
+                }
+                break;
+
+            case 'S':
+                PORTER_StopwordsFree(stop);
+                stop = PORTER_StopwordsLoad(optarg);
+                if (stop == NULL)
+                {
+                    fprintf(stderr, "%s: cannot load stopwords from %s\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+
+            case 'p':
+                sorted = 1;
+                break;
+
+            case 'j':
+                nthreads = atoi(optarg);
+                if (nthreads < 1) usage(argv[0]);
+                break;
+
+            case 'i':
+                input = optarg;
+                break;
+
+            case 'R':
+                build = optarg;
+                break;
+
+            case 'Q':
+                query = optarg;
+                break;
+
+            case 'I':
+                index = optarg;
+                break;
+
+            case 'P':
+                postings = optarg;
+                break;
+
+            case 'd':
+                delim = (unsigned char)optarg[0];
+                break;
 
-            PORTER_Stem(str);
-            fprintf(stdout, "%s -> %s\n", argv[i], str);
+            case 'C':
+                cache = optarg;
+                break;
+
+            case 'L':
+                if (strcmp(optarg, "s") == 0) spec.level = PORTER_LEVEL_S;
+                else if (strcmp(optarg, "1") == 0)
+                    spec.level = PORTER_LEVEL_STEP1;
+                else if (strcmp(optarg, "full") == 0)
+                    spec.level = PORTER_LEVEL_FULL;
+                else usage(argv[0]);
+                break;
+
+            case 'T':
+                top = atoi(optarg);
+                if (top < 1) usage(argv[0]);
+                break;
+
+            case 'q':
+                quiet = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    spec.stop = stop;
+    if (spec.level == 0) spec.level = PORTER_LEVEL_FULL;
+
+    if (index != NULL || postings != NULL)
+    {
+        if (spec.format != 0 || sorted || build || query || cache ||
+            spec.level != PORTER_LEVEL_FULL || top || quiet ||
+            (index && postings))
+            usage(argv[0]);
+
+        if (index != NULL)
+        {
+            if (optind < argc) usage(argv[0]);
+            if (buildInvIndex(index, input, delim, nthreads, stop) != 0)
+            {
+                fprintf(stderr, "%s: cannot build %s\n", argv[0], index);
+                return 1;
+            }
+
+            PORTER_StopwordsFree(stop);
+            return 0;
+        }
+
+        if (stop != NULL || input != NULL) usage(argv[0]);
+        if (queryInvIndex(postings, argc - optind, &argv[optind]) != 0)
+        {
+            fprintf(stderr, "%s: cannot open %s\n", argv[0], postings);
+            return 1;
         }
+
+        return 0;
+    }
+
+    if (build != NULL || query != NULL)
+    {
+        if (spec.format != 0 || stop != NULL || sorted || input != NULL ||
+            cache != NULL || spec.level != PORTER_LEVEL_FULL || top ||
+            quiet || (build && query))
+            usage(argv[0]);
+
+        if (build != NULL)
+        {
+            if (optind < argc) usage(argv[0]);
+            if (buildRevIndex(build, nthreads) != 0)
+            {
+                fprintf(stderr, "%s: cannot build %s\n", argv[0], build);
+                return 1;
+            }
+
+            return 0;
+        }
+
+        if (queryRevIndex(query, argc - optind, &argv[optind]) != 0)
+        {
+            fprintf(stderr, "%s: cannot open %s\n", argv[0], query);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (sorted && spec.level != PORTER_LEVEL_FULL) usage(argv[0]);
+
+    if (cache != NULL)
+    {
+        if (sorted || spec.level != PORTER_LEVEL_FULL) usage(argv[0]);
+
+        spec.cache = PORTER_CacheOpen(cache, 0);
+        if (spec.cache == NULL)
+        {
+            fprintf(stderr, "%s: cannot open cache %s\n", argv[0], cache);
+            return 1;
+        }
+    }
+
+    if (quiet && !top) usage(argv[0]);
+    if (top)
+    {
+        spec.sketch = PORTER_SketchCreate(top);
+        if (spec.sketch == NULL)
+        {
+            fprintf(stderr, "%s: cannot create a sketch of %d stems\n",
+                    argv[0], top);
+            return 1;
+        }
+    }
+
+    /* with -q, the summary is printed in place of the stems, which are
+     * never formatted at all */
+    out = quiet ? NULL : stdout;
+
+    rc = 0;
+    if (spec.format != 0)
+    {
+        if (optind < argc || sorted) usage(argv[0]);
+        if (spec.format == RECORD_JSONL && spec.key == NULL) usage(argv[0]);
     }
     else
     {
-        while (fgets(str, sizeof(str), stdin))
+        if (spec.tokens) usage(argv[0]);
+        if (optind < argc && input != NULL) usage(argv[0]);
+
+        spec.format = RECORD_LINES;
+        spec.sorted = sorted;
+    }
+
+    if (optind < argc)
+    {
+        for (i = optind; i < argc; i++)  /* for each input word... */
         {
-            int off = 0;
-            while (str[off] != '\0' && str[off] != '\n') off++;
-            str[off] = '\0';
+            strcpy(str, argv[i]);
 
-            PORTER_Stem(str);
-            fprintf(stdout, "%s\n", str);
+            stemmed = stemWord(str, stop, sorted ? &prev : NULL, spec.cache,
+                               spec.level);
+            if (stemmed == PORTER_STOPWORD) continue;
+
+            if (stemmed == 0 && spec.sketch != NULL)
+                PORTER_SketchAdd(spec.sketch, str, strlen(str));
+            if (out != NULL) fprintf(out, "%s -> %s\n", argv[i], str);
         }
     }
+    else if (stemInput(&spec, input, nthreads, out) != 0)
+    {
+        fprintf(stderr, "%s: error reading %s\n", argv[0],
+                input ? input : "input");
+        rc = 1;
+    }
 
-    return 0;
+    if (spec.cache != NULL)
+    {
+        reportCache(spec.cache);
+        PORTER_CacheClose(spec.cache);
+    }
+
+    if (spec.sketch != NULL)
+    {
+        reportSketch(spec.sketch, quiet ? stdout : stderr);
+        PORTER_SketchFree(spec.sketch);
+    }
+
+    PORTER_StopwordsFree(stop);
+    return rc;
 }
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "record.h"
+#include "source.h"
+#include "parallel.h"
+
+/* Units are claimed in order by the workers, each of which decompresses
+ * its unit and stems the records lying wholly within it.  The first and
+ * last records of a unit will usually have been cut in two by the unit's
+ * boundaries, so they are left to the writer (the calling thread), which
+ * takes the units in order, joins each unit's leading fragment to the
+ * trailing fragment of the unit before, and writes the result.  Quoted CSV
+ * fields may hold newlines, so CSV units are only decompressed by the
+ * workers and stemmed by the writer.
+ *
+ * Gzip members found by scanning for their headers may be false matches;
+ * each unit records where it ended, and the writer follows that chain,
+ * ignoring any unit which begins within one already written.  Anything
+ * which the scan missed is decompressed by the writer itself.
+ *
+ * Only a window of units beyond the one being written may be claimed, which
+ * bounds the memory held by decompressed units waiting to be written.
+ */
+
+#define PARALLEL_PENDING  0
+#define PARALLEL_DONE     1
+#define PARALLEL_FAILED   2
+
+typedef struct
+{
+    int state;
+    int split;                 /* interior records already stemmed */
+    const char *data;          /* the decompressed unit */
+    size_t len;
+    size_t head;               /* end of the leading fragment */
+    size_t tail;               /* start of the trailing fragment */
+    size_t end;                /* input offset just past the unit */
+    RECORD_Buffer scratch;
+    RECORD_Buffer out;
+} PARALLEL_Slot;
+
+typedef struct
+{
+    const RECORD_Spec *spec;
+    const SOURCE_Input *in;
+    const SOURCE_Unit *units;
+    PARALLEL_Slot *slots;
+    size_t n;
+    size_t next;               /* the next unit to be claimed */
+    size_t written;            /* the number of units written */
+    size_t expected;           /* input offset of the next unit to write */
+    size_t window;
+    PORTER_Sketch **sketches;  /* one per worker, then the writer's */
+    int nsketches;             /* the number handed out to workers */
+    int discard;               /* no output is wanted, only the sketch */
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;      /* a unit has been stemmed */
+    pthread_cond_t space;      /* a unit has been written */
+} PARALLEL_Pool;
+
+/* Decompress a unit and stem the records lying wholly within it. */
+static int PARALLEL_unit(const PARALLEL_Pool *pool, const SOURCE_Unit *u,
+                         PARALLEL_Slot *slot)
+{
+    const char *nl;
+
+    if (SOURCE_Decode(pool->in, u, &slot->scratch, &slot->data, &slot->len,
+                      &slot->end) != 0)
+        return -1;
+
+    if (pool->spec->format == RECORD_CSV) return 0;
+
+    nl = memchr(slot->data, '\n', slot->len);
+    if (nl == NULL) return 0;
+
+    slot->head = nl - slot->data + 1;
+    slot->tail = RECORD_Complete(pool->spec, slot->data, slot->len);
+    slot->split = 1;
+
+    return RECORD_StemBlock(pool->spec, &slot->data[slot->head],
+                            slot->tail - slot->head, &slot->out);
+}
+
+static void *PARALLEL_worker(void *arg)
+{
+    PARALLEL_Pool *pool;
+    PARALLEL_Slot *slot;
+    const SOURCE_Unit *u;
+    PORTER_Sketch *sketch;
+    size_t i;
+    int skip;
+    int rc;
+
+    pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    sketch = (pool->sketches != NULL) ?
+             pool->sketches[pool->nsketches++] : NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->next < pool->n &&
+               pool->next >= pool->written + pool->window)
+            pthread_cond_wait(&pool->space, &pool->lock);
+
+        if (pool->stop || pool->next >= pool->n)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        i = pool->next++;
+        u = &pool->units[i];
+        slot = &pool->slots[i];
+
+        /* a member header found within a member already written */
+        skip = (u->len == 0 && u->off < pool->expected);
+        pthread_mutex_unlock(&pool->lock);
+
+        slot->out.sketch = sketch;
+        slot->out.discard = pool->discard;
+        rc = skip ? 0 : PARALLEL_unit(pool, u, slot);
+
+        pthread_mutex_lock(&pool->lock);
+        slot->state = (rc == 0) ? PARALLEL_DONE : PARALLEL_FAILED;
+        pthread_cond_broadcast(&pool->ready);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+/* Append data to the carried-over records, and stem and write any which
+ * are now complete. */
+static int PARALLEL_feed(const RECORD_Spec *spec, RECORD_Buffer *carry,
+                         RECORD_Buffer *ob, const char *data, size_t len,
+                         FILE *out)
+{
+    size_t done;
+
+    if (RECORD_Reserve(carry, len) != 0) return -1;
+    memcpy(&carry->data[carry->len], data, len);
+    carry->len += len;
+
+    done = RECORD_Complete(spec, carry->data, carry->len);
+    if (done == 0) return 0;
+
+    ob->len = 0;
+    if (RECORD_StemBlock(spec, carry->data, done, ob) != 0) return -1;
+    if (out != NULL) fwrite(ob->data, 1, ob->len, out);
+
+    memmove(carry->data, &carry->data[done], carry->len - done);
+    carry->len -= done;
+
+    return 0;
+}
+
+/* Decompress (on this thread) input which no unit began at. */
+static int PARALLEL_gap(const PARALLEL_Pool *pool, size_t off, size_t end,
+                        RECORD_Buffer *carry, RECORD_Buffer *ob, FILE *out)
+{
+    SOURCE_Unit u;
+    RECORD_Buffer scratch;
+    const char *data;
+    size_t len;
+    size_t stop;
+    int rc;
+
+    u.off = off;
+    u.len = end - off;
+    memset(&scratch, 0x00, sizeof(scratch));
+
+    rc = SOURCE_Decode(pool->in, &u, &scratch, &data, &len, &stop);
+    if (rc == 0) rc = PARALLEL_feed(pool->spec, carry, ob, data, len, out);
+
+    free(scratch.data);
+    return rc;
+}
+
+static int PARALLEL_write(PARALLEL_Pool *pool, PORTER_Sketch *sketch,
+                          FILE *out)
+{
+    PARALLEL_Slot *slot;
+    const SOURCE_Unit *u;
+    RECORD_Buffer carry;
+    RECORD_Buffer ob;
+    size_t expected;
+    size_t i;
+    int rc;
+
+    memset(&carry, 0x00, sizeof(carry));
+    memset(&ob, 0x00, sizeof(ob));
+    ob.sketch = sketch;
+    ob.discard = (out == NULL);
+    expected = 0;
+    rc = 0;
+
+    for (i = 0; i < pool->n && rc == 0; i++)
+    {
+        u = &pool->units[i];
+        slot = &pool->slots[i];
+
+        pthread_mutex_lock(&pool->lock);
+        while (slot->state == PARALLEL_PENDING)
+            pthread_cond_wait(&pool->ready, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (u->off >= expected)
+        {
+            if (u->off > expected)
+                rc = PARALLEL_gap(pool, expected, u->off, &carry, &ob, out);
+
+            if (rc == 0 && slot->state == PARALLEL_FAILED) rc = -1;
+            if (rc == 0 && slot->split)
+            {
+                /* the leading fragment completes the carried-over record */
+                rc = PARALLEL_feed(pool->spec, &carry, &ob, slot->data,
+                                   slot->head, out);
+                if (out != NULL)
+                    fwrite(slot->out.data, 1, slot->out.len, out);
+
+                if (rc == 0)
+                    rc = PARALLEL_feed(pool->spec, &carry, &ob,
+                                       &slot->data[slot->tail],
+                                       slot->len - slot->tail, out);
+            }
+            else if (rc == 0)
+            {
+                rc = PARALLEL_feed(pool->spec, &carry, &ob, slot->data,
+                                   slot->len, out);
+            }
+
+            expected = slot->end;
+        }
+
+        free(slot->scratch.data);
+        free(slot->out.data);
+        memset(slot, 0x00, sizeof(*slot));
+
+        pthread_mutex_lock(&pool->lock);
+        pool->written = i + 1;
+        pool->expected = expected;
+        pthread_cond_broadcast(&pool->space);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (rc == 0 && expected < SOURCE_Size(pool->in))
+        rc = PARALLEL_gap(pool, expected, SOURCE_Size(pool->in), &carry, &ob,
+                          out);
+
+    /* the final record may lack a newline */
+    if (rc == 0 && carry.len > 0)
+    {
+        ob.len = 0;
+        rc = RECORD_StemBlock(pool->spec, carry.data, carry.len, &ob);
+        if (rc == 0 && out != NULL) fwrite(ob.data, 1, ob.len, out);
+    }
+
+    free(carry.data);
+    free(ob.data);
+
+    return rc;
+}
+
+int PARALLEL_Stem(const RECORD_Spec *spec, const SOURCE_Input *in,
+                  const SOURCE_Unit *units, size_t n, int nthreads,
+                  FILE *out)
+{
+    PARALLEL_Pool pool;
+    PORTER_Sketch *sketch;
+    pthread_t *tids;
+    size_t i;
+    int started;
+    int rc;
+    int t;
+
+    memset(&pool, 0x00, sizeof(pool));
+    pool.spec = spec;
+    pool.in = in;
+    pool.units = units;
+    pool.n = n;
+    pool.window = 2 * nthreads + 2;
+    pool.discard = (out == NULL);
+
+    pool.slots = calloc(n, sizeof(*pool.slots));
+    pool.sketches = RECORD_Sketches(spec, nthreads + 1);
+    tids = malloc(nthreads * sizeof(*tids));
+    if (pool.slots == NULL || tids == NULL ||
+        (spec->sketch != NULL && pool.sketches == NULL))
+    {
+        RECORD_MergeSketches(spec, pool.sketches, nthreads + 1);
+        free(pool.slots);
+        free(tids);
+        return -1;
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.ready, NULL);
+    pthread_cond_init(&pool.space, NULL);
+
+    for (started = 0; started < nthreads; started++)
+    {
+        if (pthread_create(&tids[started], NULL, PARALLEL_worker,
+                           &pool) != 0)
+            break;
+    }
+
+    /* the writer stems the records which straddle units */
+    sketch = (pool.sketches != NULL) ? pool.sketches[nthreads] : NULL;
+    rc = (started > 0) ? PARALLEL_write(&pool, sketch, out) : -1;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.space);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (t = 0; t < started; t++) pthread_join(tids[t], NULL);
+
+    if (RECORD_MergeSketches(spec, pool.sketches, nthreads + 1) != 0)
+        rc = -1;
+
+    /* units claimed but not written, if writing stopped early */
+    for (i = 0; i < n; i++)
+    {
+        free(pool.slots[i].scratch.data);
+        free(pool.slots[i].out.data);
+    }
+
+    pthread_cond_destroy(&pool.space);
+    pthread_cond_destroy(&pool.ready);
+    pthread_mutex_destroy(&pool.lock);
+
+    free(pool.slots);
+    free(tids);
+
+    return rc;
+}
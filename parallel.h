@@ -0,0 +1,26 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <stdio.h>
+
+#include "record.h"
+#include "source.h"
+
+/** Decompress and stem the units of an input across a number of threads,
+ *  writing the result (in order) to out.  If out is NULL, nothing is
+ *  written (or formatted): the stems only go to the spec's sketch.
+ *
+ *  @param spec      the record specification.
+ *  @param in        the input, which must be mapped.
+ *  @param units     the input's units, from SOURCE_Units().
+ *  @param n         the number of units.
+ *  @param nthreads  the number of threads to decompress and stem with.
+ *  @param out       the output, or NULL.
+ *
+ *  @return 0 on success, -1 on failure.
+ */
+int PARALLEL_Stem(const RECORD_Spec *spec, const SOURCE_Input *in,
+                  const SOURCE_Unit *units, size_t n, int nthreads,
+                  FILE *out);
+
+#endif
@@ -0,0 +1,492 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "record.h"
+#include "source.h"
+#include "pipeline.h"
+
+/* A streamed input is stemmed by a pipeline of threads:
+ *
+ *   reader      reads the input into blocks, each cut at the end of its
+ *               last complete record, and numbers them in order
+ *   workers     stem blocks; block n goes to worker n % nworkers
+ *   writer      (the calling thread) writes the blocks in order
+ *
+ * The stages are joined by lock-free rings of block pointers: a
+ * single-producer, single-consumer ring from the reader to each worker, a
+ * multiple-producer ring from the workers to the writer, and another
+ * single-producer ring carrying written blocks back to the reader.  Blocks
+ * may finish out of order; the writer holds each one until those before it
+ * have been written.
+ *
+ * There is a fixed number of blocks, and the reader can only read into one
+ * which the writer has given back, which bounds memory (and so holds the
+ * reader back when the writer or the workers fall behind).  Since no ring
+ * can hold more than every block, none can ever be full.
+ *
+ * A thread finding its ring empty spins briefly and then sleeps on a futex;
+ * a producer only makes the futex call if a consumer is asleep.
+ */
+
+#define PIPELINE_BLOCK  (1 << 20)
+#define PIPELINE_SPIN   256
+#define PIPELINE_PAD    64
+
+typedef struct
+{
+    uint64_t seq;
+    int last;                  /* the final block of the input */
+    int failed;
+    RECORD_Buffer in;
+    RECORD_Buffer out;
+} PIPELINE_Block;
+
+/* Counts pushes, so that a consumer can sleep until the next one. */
+typedef struct
+{
+    uint32_t count;
+    uint32_t sleepers;
+} PIPELINE_Event;
+
+typedef struct
+{
+    PIPELINE_Block **items;
+    uint64_t mask;
+    char pad0[PIPELINE_PAD];
+    uint64_t head;             /* written by the producer */
+    char pad1[PIPELINE_PAD];
+    uint64_t tail;             /* written by the consumer */
+    char pad2[PIPELINE_PAD];
+    PIPELINE_Event ready;
+} PIPELINE_Spsc;
+
+typedef struct
+{
+    uint64_t seq;
+    PIPELINE_Block *item;
+} PIPELINE_Cell;
+
+/* A bounded ring for many producers and one consumer; each cell's sequence
+ * number says whether it is free for the producer at that position or
+ * filled for the consumer. */
+typedef struct
+{
+    PIPELINE_Cell *cells;
+    uint64_t mask;
+    char pad0[PIPELINE_PAD];
+    uint64_t head;             /* claimed by producers */
+    char pad1[PIPELINE_PAD];
+    uint64_t tail;             /* the consumer's position */
+    char pad2[PIPELINE_PAD];
+    PIPELINE_Event ready;
+} PIPELINE_Mpsc;
+
+typedef struct
+{
+    const RECORD_Spec *spec;
+    SOURCE_Input *in;
+    int nworkers;
+    PIPELINE_Spsc *work;       /* one per worker */
+    PIPELINE_Mpsc done;
+    PIPELINE_Spsc free;
+} PIPELINE;
+
+typedef struct
+{
+    PIPELINE *p;
+    int id;
+    PORTER_Sketch *sketch;     /* the worker's own, if stems are counted */
+} PIPELINE_Worker;
+
+typedef int (*PIPELINE_Pop)(void *ring, PIPELINE_Block **b);
+
+static void PIPELINE_notify(PIPELINE_Event *e)
+{
+    __atomic_fetch_add(&e->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&e->sleepers, __ATOMIC_SEQ_CST) != 0)
+        syscall(SYS_futex, &e->count, FUTEX_WAKE_PRIVATE, INT_MAX, NULL,
+                NULL, 0);
+
+    return;
+}
+
+static void PIPELINE_sleep(PIPELINE_Event *e, uint32_t count)
+{
+    syscall(SYS_futex, &e->count, FUTEX_WAIT_PRIVATE, count, NULL, NULL, 0);
+    return;
+}
+
+static int PIPELINE_initSpsc(PIPELINE_Spsc *r, uint64_t size)
+{
+    memset(r, 0x00, sizeof(*r));
+
+    r->items = calloc(size, sizeof(*r->items));
+    if (r->items == NULL) return -1;
+    r->mask = size - 1;
+
+    return 0;
+}
+
+static void PIPELINE_pushSpsc(PIPELINE_Spsc *r, PIPELINE_Block *b)
+{
+    uint64_t head;
+
+    head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    r->items[head & r->mask] = b;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    PIPELINE_notify(&r->ready);
+    return;
+}
+
+static int PIPELINE_popSpsc(void *ring, PIPELINE_Block **b)
+{
+    PIPELINE_Spsc *r = ring;
+    uint64_t tail;
+
+    tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) return 0;
+
+    *b = r->items[tail & r->mask];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static int PIPELINE_initMpsc(PIPELINE_Mpsc *r, uint64_t size)
+{
+    uint64_t i;
+
+    memset(r, 0x00, sizeof(*r));
+
+    r->cells = calloc(size, sizeof(*r->cells));
+    if (r->cells == NULL) return -1;
+    r->mask = size - 1;
+
+    for (i = 0; i < size; i++) r->cells[i].seq = i;
+
+    return 0;
+}
+
+static void PIPELINE_pushMpsc(PIPELINE_Mpsc *r, PIPELINE_Block *b)
+{
+    PIPELINE_Cell *cell;
+    uint64_t pos;
+
+    /* never full, so the claimed cell only needs to have been consumed */
+    pos = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    cell = &r->cells[pos & r->mask];
+
+    while (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos)
+        sched_yield();
+
+    cell->item = b;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    PIPELINE_notify(&r->ready);
+    return;
+}
+
+static int PIPELINE_popMpsc(void *ring, PIPELINE_Block **b)
+{
+    PIPELINE_Mpsc *r = ring;
+    PIPELINE_Cell *cell;
+
+    cell = &r->cells[r->tail & r->mask];
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != r->tail + 1)
+        return 0;
+
+    *b = cell->item;
+    __atomic_store_n(&cell->seq, r->tail + r->mask + 1, __ATOMIC_RELEASE);
+    r->tail++;
+
+    return 1;
+}
+
+/* Take the next block from a ring, sleeping until there is one. */
+static PIPELINE_Block *PIPELINE_take(PIPELINE_Pop pop, void *ring,
+                                     PIPELINE_Event *e)
+{
+    PIPELINE_Block *b;
+    uint32_t count;
+    int found;
+    int spin;
+
+    for (spin = 0; spin < PIPELINE_SPIN; spin++)
+    {
+        if (pop(ring, &b)) return b;
+    }
+
+    for (;;)
+    {
+        count = __atomic_load_n(&e->count, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&e->sleepers, 1, __ATOMIC_SEQ_CST);
+
+        /* a push since count was read changes it, so this can't miss one */
+        found = pop(ring, &b);
+        if (!found) PIPELINE_sleep(e, count);
+
+        __atomic_fetch_sub(&e->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (found) return b;
+    }
+}
+
+/* Fill a block with whole records, carrying any partial record over. */
+static void PIPELINE_fill(PIPELINE *p, PIPELINE_Block *b,
+                          RECORD_Buffer *carry, int *eof)
+{
+    RECORD_Buffer *in = &b->in;
+    size_t done;
+    ssize_t n;
+
+    in->len = 0;
+    b->out.len = 0;
+    b->failed = 0;
+
+    if (RECORD_Reserve(in, PIPELINE_BLOCK + carry->len) != 0)
+    {
+        b->failed = 1;
+        *eof = 1;
+        return;
+    }
+
+    memcpy(in->data, carry->data, carry->len);
+    in->len = carry->len;
+    carry->len = 0;
+
+    for (;;)
+    {
+        if (in->len == in->cap && RECORD_Reserve(in, in->cap) != 0)
+        {
+            b->failed = 1;
+            *eof = 1;
+            return;
+        }
+
+        n = SOURCE_Read(p->in, &in->data[in->len], in->cap - in->len);
+        if (n <= 0)
+        {
+            /* the final record may lack a newline */
+            b->failed = (n < 0);
+            *eof = 1;
+            return;
+        }
+
+        in->len += n;
+
+        /* a block is handed on when full, or as soon as the input goes
+         * quiet, so that a slow stream (tail -f) is answered line by line
+         * while a fast one still fills whole blocks */
+        if (in->len < in->cap && SOURCE_Ready(p->in)) continue;
+
+        done = RECORD_Complete(p->spec, in->data, in->len);
+        if (done == 0) continue;   /* no complete record yet */
+
+        if (RECORD_Reserve(carry, in->len - done) != 0)
+        {
+            b->failed = 1;
+            *eof = 1;
+            return;
+        }
+
+        memcpy(carry->data, &in->data[done], in->len - done);
+        carry->len = in->len - done;
+        in->len = done;
+        return;
+    }
+}
+
+static void *PIPELINE_reader(void *arg)
+{
+    PIPELINE *p = arg;
+    PIPELINE_Block *b;
+    RECORD_Buffer carry;
+    uint64_t seq;
+    int eof;
+
+    memset(&carry, 0x00, sizeof(carry));
+    eof = 0;
+
+    for (seq = 0; !eof; seq++)
+    {
+        b = PIPELINE_take(PIPELINE_popSpsc, &p->free, &p->free.ready);
+
+        PIPELINE_fill(p, b, &carry, &eof);
+        b->seq = seq;
+        b->last = eof;
+
+        PIPELINE_pushSpsc(&p->work[seq % p->nworkers], b);
+    }
+
+    free(carry.data);
+    return NULL;
+}
+
+static void *PIPELINE_worker(void *arg)
+{
+    PIPELINE_Worker *w = arg;
+    PIPELINE *p = w->p;
+    PIPELINE_Block *b;
+
+    for (;;)
+    {
+        b = PIPELINE_take(PIPELINE_popSpsc, &p->work[w->id],
+                          &p->work[w->id].ready);
+        if (b == NULL) break;
+
+        b->out.sketch = w->sketch;
+        if (!b->failed &&
+            RECORD_StemBlock(p->spec, b->in.data, b->in.len, &b->out) != 0)
+            b->failed = 1;
+
+        PIPELINE_pushMpsc(&p->done, b);
+    }
+
+    return NULL;
+}
+
+/* Write blocks in order until the last, returning each to the reader. */
+static int PIPELINE_write(PIPELINE *p, PIPELINE_Block **held, size_t nblocks,
+                          FILE *out)
+{
+    PIPELINE_Block *b;
+    uint64_t next;
+    int last;
+    int rc;
+
+    rc = 0;
+    last = 0;
+
+    for (next = 0; !last; next++)
+    {
+        while (held[next % nblocks] == NULL)
+        {
+            b = PIPELINE_take(PIPELINE_popMpsc, &p->done, &p->done.ready);
+            held[b->seq % nblocks] = b;
+        }
+
+        b = held[next % nblocks];
+        held[next % nblocks] = NULL;
+
+        /* after a failure, the rest of the input is drained unwritten */
+        if (b->failed) rc = -1;
+        if (rc == 0 && out != NULL) fwrite(b->out.data, 1, b->out.len, out);
+
+        last = b->last;
+        PIPELINE_pushSpsc(&p->free, b);
+    }
+
+    return rc;
+}
+
+int PIPELINE_Stem(const RECORD_Spec *spec, SOURCE_Input *in, int nthreads,
+                  FILE *out)
+{
+    PIPELINE p;
+    PIPELINE_Block *blocks;
+    PIPELINE_Block **held;
+    PIPELINE_Worker *workers;
+    PORTER_Sketch **sketches;
+    pthread_t *tids;
+    pthread_t reader;
+    size_t nblocks;
+    size_t size;
+    size_t i;
+    int started;
+    int rc;
+
+    memset(&p, 0x00, sizeof(p));
+    p.spec = spec;
+    p.in = in;
+    p.nworkers = (nthreads > 0) ? nthreads : 1;
+
+    /* two blocks a worker, plus one each being read and written */
+    nblocks = 2 * p.nworkers + 2;
+    for (size = 1; size <= nblocks; size *= 2)
+        ;
+
+    blocks = calloc(nblocks, sizeof(*blocks));
+    held = calloc(nblocks, sizeof(*held));
+    workers = calloc(p.nworkers, sizeof(*workers));
+    tids = calloc(p.nworkers, sizeof(*tids));
+    p.work = calloc(p.nworkers, sizeof(*p.work));
+    sketches = RECORD_Sketches(spec, p.nworkers);
+
+    rc = -1;
+    started = 0;
+    if (blocks == NULL || held == NULL || workers == NULL || tids == NULL ||
+        p.work == NULL || (spec->sketch != NULL && sketches == NULL))
+        goto done;
+
+    if (PIPELINE_initMpsc(&p.done, size) != 0 ||
+        PIPELINE_initSpsc(&p.free, size) != 0)
+        goto done;
+
+    for (i = 0; i < (size_t)p.nworkers; i++)
+    {
+        if (PIPELINE_initSpsc(&p.work[i], size) != 0) goto done;
+    }
+
+    for (i = 0; i < nblocks; i++)
+    {
+        blocks[i].out.discard = (out == NULL);
+        PIPELINE_pushSpsc(&p.free, &blocks[i]);
+    }
+
+    for (started = 0; started < p.nworkers; started++)
+    {
+        workers[started].p = &p;
+        workers[started].id = started;
+        if (sketches != NULL) workers[started].sketch = sketches[started];
+        if (pthread_create(&tids[started], NULL, PIPELINE_worker,
+                           &workers[started]) != 0)
+            break;
+    }
+
+    /* blocks are dealt out to every worker, so all of them must run */
+    if (started == p.nworkers &&
+        pthread_create(&reader, NULL, PIPELINE_reader, &p) == 0)
+    {
+        rc = PIPELINE_write(&p, held, nblocks, out);
+        pthread_join(reader, NULL);
+    }
+
+    for (i = 0; i < (size_t)started; i++)
+        PIPELINE_pushSpsc(&p.work[i], NULL);
+    for (i = 0; i < (size_t)started; i++) pthread_join(tids[i], NULL);
+
+done:
+    if (RECORD_MergeSketches(spec, sketches, p.nworkers) != 0) rc = -1;
+
+    if (blocks != NULL)
+    {
+        for (i = 0; i < nblocks; i++)
+        {
+            free(blocks[i].in.data);
+            free(blocks[i].out.data);
+        }
+    }
+
+    if (p.work != NULL)
+    {
+        for (i = 0; i < (size_t)p.nworkers; i++) free(p.work[i].items);
+    }
+
+    free(p.done.cells);
+    free(p.free.items);
+    free(p.work);
+    free(tids);
+    free(workers);
+    free(held);
+    free(blocks);
+
+    return rc;
+}
@@ -0,0 +1,20 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <stdio.h>
+
+#include "record.h"
+#include "source.h"
+
+/** Stem a streamed input (one which can't be split ahead of time, such as
+ *  a pipe) in a pipeline of threads: a reader cutting the input into
+ *  blocks of whole records, nthreads workers stemming them, and the calling
+ *  thread writing the results to out in order.  If out is NULL, nothing
+ *  is written (or formatted): the stems only go to the spec's sketch.
+ *
+ *  @return 0 on success, -1 on failure.
+ */
+int PIPELINE_Stem(const RECORD_Spec *spec, SOURCE_Input *in, int nthreads,
+                  FILE *out);
+
+#endif
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "porter.h"
+
+/* A plan splits a packed batch of words into tasks for someone else's
+ * threads to run.  A word's cost is taken to be the bytes its stemming
+ * touches: the word, its stem, and an offset read and a length written.
+ * The cost of the first j words is then known from the offsets alone, so
+ * the task boundaries are found by binary search for equal shares of the
+ * total, without a pass over the words.
+ *
+ * Each task stems its words into out at their own offsets (a stem is never
+ * longer than its word), recording each stem's length in the stems array;
+ * tasks so write disjoint parts of both and share nothing else.  Finishing
+ * packs the stems down and turns the lengths into offsets.
+ */
+
+#define PORTER_PLAN_GRAIN  32768   /* cost per task, by default */
+#define PORTER_PLAN_WORD   (2 * sizeof(size_t))
+
+struct PORTER_Plan
+{
+    const char *arena;
+    const size_t *offsets;
+    size_t n;
+    char *out;
+    size_t *stems;
+    PORTER_Task *tasks;
+    size_t ntasks;
+};
+
+/* The cost of the first j words. */
+static inline size_t PORTER_planCost(const PORTER_Plan *plan, size_t j)
+{
+    return 2 * (plan->offsets[j] - plan->offsets[0]) + j * PORTER_PLAN_WORD;
+}
+
+/* The fewest words whose cost reaches target. */
+static size_t PORTER_planSplit(const PORTER_Plan *plan, size_t target)
+{
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    lo = 0;
+    hi = plan->n;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (PORTER_planCost(plan, mid) < target) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+PORTER_Plan *PORTER_PlanCreate(const char *arena, const size_t *offsets,
+                               size_t n, char *out, size_t *stems,
+                               size_t grain)
+{
+    PORTER_Plan *plan;
+    size_t total;
+    size_t share;
+    size_t rem;
+    size_t start;
+    size_t end;
+    size_t k;
+
+    if (grain == 0) grain = PORTER_PLAN_GRAIN;
+
+    plan = calloc(1, sizeof(*plan));
+    if (plan == NULL) return NULL;
+
+    plan->arena = arena;
+    plan->offsets = offsets;
+    plan->n = n;
+    plan->out = out;
+    plan->stems = stems;
+
+    total = PORTER_planCost(plan, n);
+    plan->ntasks = (n == 0) ? 0 : (total + grain - 1) / grain;
+    if (plan->ntasks > n) plan->ntasks = n;
+
+    plan->tasks = malloc(plan->ntasks * sizeof(*plan->tasks) + 1);
+    if (plan->tasks == NULL)
+    {
+        free(plan);
+        return NULL;
+    }
+
+    share = (plan->ntasks > 0) ? total / plan->ntasks : 0;
+    rem = (plan->ntasks > 0) ? total % plan->ntasks : 0;
+
+    start = 0;
+    for (k = 0; k < plan->ntasks; k++)
+    {
+        /* the k + 1'th share of the total, without overflow */
+        end = (k + 1 == plan->ntasks) ? n :
+              PORTER_planSplit(plan, share * (k + 1) +
+                                     rem * (k + 1) / plan->ntasks);
+
+        /* a single word may cost more than a share */
+        if (end <= start) end = start + 1;
+
+        plan->tasks[k].first = start;
+        plan->tasks[k].n = end - start;
+        plan->tasks[k].cost = PORTER_planCost(plan, end) -
+                              PORTER_planCost(plan, start);
+        start = end;
+
+        if (start == n)
+        {
+            plan->ntasks = k + 1;
+            break;
+        }
+    }
+
+    return plan;
+}
+
+void PORTER_PlanFree(PORTER_Plan *plan)
+{
+    if (plan == NULL) return;
+
+    free(plan->tasks);
+    free(plan);
+
+    return;
+}
+
+size_t PORTER_PlanTasks(const PORTER_Plan *plan)
+{
+    return plan->ntasks;
+}
+
+const PORTER_Task *PORTER_PlanTask(const PORTER_Plan *plan, size_t task)
+{
+    return &plan->tasks[task];
+}
+
+size_t PORTER_PlanRun(const PORTER_Plan *plan, size_t task)
+{
+    const PORTER_Task *t;
+    char word[PORTER_MAXWORD + 1];
+    size_t stemmed;
+    size_t start;
+    size_t len;
+    size_t i;
+
+    t = &plan->tasks[task];
+    stemmed = 0;
+
+    for (i = t->first; i < t->first + t->n; i++)
+    {
+        start = plan->offsets[i];
+        len = plan->offsets[i + 1] - start;
+
+        if (len >= 1 && len <= PORTER_MAXWORD &&
+            memchr(plan->arena + start, '\0', len) == NULL)
+        {
+            memcpy(word, plan->arena + start, len);
+            word[len] = '\0';
+            if (PORTER_Stem(word) == 0) stemmed++;
+            len = strlen(word);
+            memcpy(plan->out + start, word, len);
+        }
+        else if (plan->out != plan->arena)
+        {
+            memcpy(plan->out + start, plan->arena + start, len);
+        }
+
+        plan->stems[i + 1] = len;
+    }
+
+    return stemmed;
+}
+
+size_t PORTER_PlanFinish(PORTER_Plan *plan)
+{
+    size_t pos;
+    size_t len;
+    size_t i;
+
+    /* a stem packed down never reaches past the start of its word */
+    pos = 0;
+    for (i = 0; i < plan->n; i++)
+    {
+        len = plan->stems[i + 1];
+        memmove(plan->out + pos, plan->out + plan->offsets[i], len);
+        pos += len;
+        plan->stems[i + 1] = pos;
+    }
+
+    plan->stems[0] = 0;
+    return pos;
+}
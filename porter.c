@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <ctype.h>
 
+#include "porter.h"
+
 /* The flag used in the map is an unsigned 8 bit value:
  *
  *   x x x    x x x x x
@@ -116,26 +118,15 @@ static inline char PORTER_isCV(char *str, int pos)
     return 'C';
 }
 
-static inline int PORTER_ReMeasure(char *word, int off, uint8_t *map)
+/* The measuring loop proper: carry on from position off, given the state
+ * (measure, class of the previous letter, whether a vowel has been seen)
+ * accumulated over the letters before it. */
+static inline int PORTER_measureFrom(char *word, int off, int m, char prev,
+                                     uint8_t hasVowel, uint8_t *map)
 {
     int i;
-    int m;
-    char cur, prev;
+    char cur;
     uint8_t flags;
-    uint8_t hasVowel;
-
-    if (off == 0)
-    {
-        m = 0;
-        prev = 'C';
-        hasVowel = 0;
-    }
-    else
-    {
-        m = PORTER_getMeasure(map[off]);
-        prev = PORTER_isCV(word, off);
-        hasVowel = PORTER_hasVowel(map[off]);
-    }
 
     for (i = off; word[i] != '\0'; i++)
     {
@@ -176,6 +167,28 @@ static inline int PORTER_ReMeasure(char *word, int off, uint8_t *map)
     return m;
 }
 
+static inline int PORTER_ReMeasure(char *word, int off, uint8_t *map)
+{
+    if (off == 0) return PORTER_measureFrom(word, 0, 0, 'C', 0, map);
+
+    return PORTER_measureFrom(word, off, PORTER_getMeasure(map[off]),
+                              PORTER_isCV(word, off),
+                              PORTER_hasVowel(map[off]), map);
+}
+
+/* Measure a word whose map is already valid (and whose letters are already
+ * uppercased) for positions 0 to off - 1.  Since the measure and flags at
+ * each position depend only on the letters up to it, the result is exactly
+ * that of measuring the whole word. */
+static inline int PORTER_MeasureAfter(char *word, int off, uint8_t *map)
+{
+    if (off == 0) return PORTER_measureFrom(word, 0, 0, 'C', 0, map);
+
+    return PORTER_measureFrom(word, off, PORTER_getMeasure(map[off - 1]),
+                              PORTER_isCV(word, off - 1),
+                              PORTER_hasVowel(map[off - 1]), map);
+}
+
 /** Measure (by the Porter definition) a word.
  *
  *  @param word  the word to be measured.
@@ -290,7 +303,7 @@ static inline int PORTER_step1b(char *word, int len, uint8_t *map)
     /* (*v*) ED ->  */
     if (PORTER_endsWith(word, len, "ED", 2))
     {
-        if (PORTER_hasVowel(map[len - 3]) != 0)
+        if (len > 2 && PORTER_hasVowel(map[len - 3]) != 0)
         {
             len -= 2;
             word[len] = '\0';
@@ -301,7 +314,7 @@ static inline int PORTER_step1b(char *word, int len, uint8_t *map)
     /* (*v*) ING ->  */
     else if (PORTER_endsWith(word, len, "ING", 3))
     {
-        if (PORTER_hasVowel(map[len - 4]) != 0)
+        if (len > 3 && PORTER_hasVowel(map[len - 4]) != 0)
         {
             len -= 3;
             word[len] = '\0';  /* truncate last three letters */
@@ -374,7 +387,7 @@ static inline int PORTER_step1c(char *word, int len, uint8_t *map)
 #endif
 
     /* (*v*) Y -> I */
-    if (word[len - 1] == 'Y' &&
+    if (len > 1 && word[len - 1] == 'Y' &&
         PORTER_hasVowel(map[len - 2]) != 0)
     {
         word[len - 1] = 'I';
@@ -390,6 +403,11 @@ static inline int PORTER_step2(char *word, int len, uint8_t *map)
     fprintf(stderr, "%s() -> '%s'\n", __func__, word);
 #endif
 
+    /* every rule wants m>0 (two letters) before a suffix of at least
+     * three, so nothing shorter can match (and no stem is read from
+     * before the start of the word) */
+    if (len < 5) return len;
+
     switch (word[len - 1])
     {
         case 'I':
@@ -559,7 +577,7 @@ static inline int PORTER_step2(char *word, int len, uint8_t *map)
             break;
 
         case 'N':
-            if (len < 6) return 0;
+            if (len < 6) return len;
 
             /* (m>0) IZATION ->  IZE  */
             if (PORTER_endsWith(word, len, "IZATION", 7))
@@ -652,6 +670,11 @@ static inline int PORTER_step3(char *word, int len, uint8_t *map)
     fprintf(stderr, "%s() -> '%s'\n", __func__, word);
 #endif
 
+    /* every rule wants m>0 (two letters) before a suffix of at least
+     * three, so nothing shorter can match (and no stem is read from
+     * before the start of the word) */
+    if (len < 5) return len;
+
     switch (word[len - 1])
     {
         case 'E':
@@ -754,6 +777,11 @@ static inline int PORTER_step4(char *word, int len, uint8_t *map)
     fprintf(stderr, "%s() -> '%s'\n", __func__, word);
 #endif
 
+    /* every rule wants m>1 (four letters) before a suffix of at least
+     * two, so nothing shorter can match (and no stem is read from
+     * before the start of the word) */
+    if (len < 6) return len;
+
     switch (word[len - 1])
     {
         case 'C':
@@ -1028,8 +1056,8 @@ static inline int PORTER_step5a(char *word, int len, uint8_t *map)
     fprintf(stderr, "%s() -> '%s'\n", __func__, word);
 #endif
 
-    if (word[len - 1] != 'E') return len;
     if (len < 3) return len;
+    if (word[len - 1] != 'E') return len;
 
     /* (m>1) E     ->          */
     if (PORTER_getMeasure(map[len - 2]) > 1)
@@ -1060,7 +1088,7 @@ static inline int PORTER_step5b(char *word, int len, uint8_t *map)
 #endif
 
     /* (m > 1 and *d and *L) -> single letter  */
-    if (word[len - 1] == 'L' && word[len - 2] == 'L')
+    if (len > 2 && word[len - 1] == 'L' && word[len - 2] == 'L')
     {
         if (PORTER_getMeasure(map[len - 1]) > 1)
         {
@@ -1072,31 +1100,793 @@ static inline int PORTER_step5b(char *word, int len, uint8_t *map)
     return len;
 }
 
+/* Apply the rules to a measured word, returning the length of the stem. */
+static inline int PORTER_steps(char *word, int len, uint8_t *map)
+{
+    len = PORTER_step1a(word, len, map);
+    len = PORTER_step1b(word, len, map);
+    len = PORTER_step1c(word, len, map);
+    len = PORTER_step2(word, len, map);
+    len = PORTER_step3(word, len, map);
+    len = PORTER_step4(word, len, map);
+    len = PORTER_step5a(word, len, map);
+    len = PORTER_step5b(word, len, map);
+
+    return len;
+}
+
+#define PORTER_HASH_P1 0x9E3779B185EBCA87ULL
+#define PORTER_HASH_P2 0xC2B2AE3D27D4EB4FULL
+#define PORTER_HASH_P3 0x165667B19E3779F9ULL
+#define PORTER_HASH_P4 0x85EBCA77C2B2AE63ULL
+#define PORTER_HASH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t PORTER_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* Read 8 bytes as a little-endian number, so that hashes are the same on
+ * every host. */
+static inline uint64_t PORTER_lane(const char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/* A 64-bit hash of len bytes: the lane and finalization steps of xxHash64,
+ * with the tail zero-padded to a whole lane (the length is mixed in, so
+ * padding can't collide with real zero bytes). */
+uint64_t PORTER_Hash(const char *p, size_t len, uint64_t seed)
+{
+    char tail[8];
+    uint64_t h;
+    uint64_t k;
+    size_t i;
+
+    h = seed + PORTER_HASH_P5 + len;
+
+    for (i = 0; i < len; i += 8)
+    {
+        if (len - i >= 8) k = PORTER_lane(&p[i]);
+        else
+        {
+            memset(tail, 0x00, sizeof(tail));
+            memcpy(tail, &p[i], len - i);
+            k = PORTER_lane(tail);
+        }
+
+        k = PORTER_rotl(k * PORTER_HASH_P2, 31) * PORTER_HASH_P1;
+        h = PORTER_rotl(h ^ k, 27) * PORTER_HASH_P1 + PORTER_HASH_P4;
+    }
+
+    h ^= h >> 33;
+    h *= PORTER_HASH_P2;
+    h ^= h >> 29;
+    h *= PORTER_HASH_P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+/* Each byte of a lane with only its high bit set. */
+#define PORTER_LANE_HIGH  0x8080808080808080ULL
+
+/* Is every byte of a lane an ASCII letter?  OR-ing in 0x20 folds upper case
+ * onto lower; adding 0x1f then sets a byte's high bit from 'a' up, and
+ * adding 0x05 sets it past 'z'.  With the high bits clear to begin with, no
+ * byte carries into the next, so a lane is checked in a few instructions.
+ */
+static inline int PORTER_letters(uint64_t x)
+{
+    uint64_t y;
+
+    if (x & PORTER_LANE_HIGH) return 0;
+
+    y = x | 0x2020202020202020ULL;
+    return ((y + 0x1f1f1f1f1f1f1f1fULL) & ~(y + 0x0505050505050505ULL) &
+            PORTER_LANE_HIGH) == PORTER_LANE_HIGH;
+}
+
+/* Can a word be stemmed: is it 1 to PORTER_MAXWORD bytes long and all
+ * ASCII letters?  Anything else is turned away here, having cost at most
+ * four lanes, before any of it is measured. */
+static inline int PORTER_valid(const char *w, size_t n)
+{
+    uint64_t x;
+    size_t i;
+
+    if (n < 1 || n > PORTER_MAXWORD) return 0;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        memcpy(&x, &w[i], sizeof(x));
+        if (!PORTER_letters(x)) return 0;
+    }
+
+    if (i == n) return 1;
+
+    /* pad the last lane with letters */
+    memset(&x, 'a', sizeof(x));
+    memcpy(&x, &w[i], n - i);
+    return PORTER_letters(x);
+}
+
+/* The length of a terminated word, reading no further than needed to know
+ * it is too long to stem. */
+static inline size_t PORTER_length(const char *word)
+{
+    return strnlen(word, PORTER_MAXWORD + 1);
+}
+
+/* Measure a word which can be stemmed and apply the rules to it, returning
+ * the length of the stem.  A rule whose suffix is the whole word reads the
+ * measure of an empty stem from before the start of the map, so the map
+ * has a zero byte there. */
+static inline int PORTER_stemWord(char *word, int len)
+{
+    uint8_t map[PORTER_MAXWORD + 2];
+
+    map[0] = 0;
+    PORTER_Measure(word, &map[1]);
+#ifdef DEBUG
+    PORTER_DumpMap(word, &map[1]);
+#endif
+
+    return PORTER_steps(word, len, &map[1]);
+}
+
 int PORTER_Stem(char *word)
 {
     int len;
-    uint8_t *map;
 
-    len = strlen(word);
-    map = alloca(len);
-    memset(map, 0x00, len);
+    len = PORTER_length(word);
+    if (!PORTER_valid(word, len)) return -1;
 
-    /* check for valid length */
-    if (len < 1 || len > 31) return -1;
+    PORTER_stemWord(word, len);
+
+    return 0;
+}
+
+int PORTER_IsWord(const char *w, size_t n)
+{
+    return PORTER_valid(w, n);
+}
+
+int PORTER_StemPrefix(char *word, PORTER_Prefix *prev)
+{
+    int len;
+    int off;
+    int i;
+    uint8_t map[sizeof(prev->map) + 1];
+
+    len = PORTER_length(word);
+    if (!PORTER_valid(word, len)) return -1;
+
+    /* the map of the prefix shared with the previous word is unchanged, so
+     * that part of the word only needs uppercasing (from the saved copy) */
+    off = (prev->len < len) ? prev->len : len;
+    for (i = 0; i < off; i++)
+    {
+        if (word[i] != prev->raw[i]) break;
+        word[i] = prev->word[i];
+    }
+
+    off = i;
+    memcpy(&prev->raw[off], &word[off], len - off);
+
+    /* measure the rest straight into the saved map, and keep the measured
+     * word for the next call before the rules change it */
+    PORTER_MeasureAfter(word, off, prev->map);
+    memcpy(&prev->word[off], &word[off], len - off);
+    prev->len = len;
 
-    PORTER_Measure(word, map);
 #ifdef DEBUG
-    PORTER_DumpMap(word, map);
+    PORTER_DumpMap(word, prev->map);
 #endif
 
+    /* with a zero byte before it, as PORTER_stemWord() has */
+    map[0] = 0;
+    memcpy(&map[1], prev->map, sizeof(prev->map));
+    PORTER_steps(word, len, &map[1]);
+
+    return 0;
+}
+
+size_t PORTER_StemSorted(char **words, size_t n)
+{
+    PORTER_Prefix prev;
+    size_t stemmed;
+    size_t i;
+
+    memset(&prev, 0x00, sizeof(prev));
+    stemmed = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (PORTER_StemPrefix(words[i], &prev) == 0) stemmed++;
+    }
+
+    return stemmed;
+}
+
+typedef int (*PORTER_StepFn)(char *word, int len, uint8_t *map);
+
+/* How far from the end of a word the steps after a point can still reach:
+ * none of them changes a letter before len - reach, or leaves the word
+ * shorter than that (and none makes it longer; step 1b only adds an E
+ * after taking off two letters or more).  The reach of each step is the
+ * most its rules can change from the end: 2 for 1a, 4 for 1b, 5 for each
+ * of 2 (BILITI -> BLE), 3 and 4, and 1 for 1c, 5a and 5b. */
+#define PORTER_REACH     24    /* before any step */
+#define PORTER_REACH1    17    /* after step 1 */
+#define PORTER_REACH3    7     /* after step 3 */
+
+/* The number of leading letters of a measured word which the rules still
+ * to come can never change, however long its suffix.  Steps 1b and 1c only
+ * cut the word after a vowel, and step 1a never touches more than the last
+ * two letters.  Every later rule needs a measure of at least 1 in what it
+ * leaves, so keeps everything up to where the measure first reaches 1 (and
+ * a word which never gets there is already its own stem). */
+static inline int PORTER_fixed(const uint8_t *map, int len, int after1)
+{
+    int i;
+
+    if (!after1)
+    {
+        for (i = 0; i < len && !PORTER_hasVowel(map[i]); i++);
+        i = (i + 1 < len - 2) ? i + 1 : len - 2;
+        return (i > 0) ? i : 0;
+    }
+
+    for (i = 0; i < len && PORTER_getMeasure(map[i]) == 0; i++);
+    return (i < len) ? i + 1 : len;
+}
+
+/* Of a word part way through stemming, the leading letters which are
+ * certain to be in its stem. */
+static inline int PORTER_settled(int fixed, int len, int reach)
+{
+    return (fixed > len - reach) ? fixed : len - reach;
+}
+
+/* The stem of a word, as PORTER_Stem() would leave it: stemmed into buf
+ * if it can be stemmed, and otherwise the word itself. */
+static const char *PORTER_stemOf(const char *word, size_t len, char *buf)
+{
+    if (!PORTER_valid(word, len)) return word;
+
+    memcpy(buf, word, len + 1);
+    PORTER_Stem(buf);
+
+    return buf;
+}
+
+/* A word part way through stemming, compared as it goes with another or
+ * with a finished stem. */
+typedef struct
+{
+    char word[PORTER_MAXWORD + 1];
+    uint8_t map[PORTER_MAXWORD + 2];  /* from map[1]; map[0] is read */
+    int len;
+    int fixed;
+    int checked;         /* leading letters settled and found to match */
+} PORTER_Partial;
+
+static inline void PORTER_startPartial(PORTER_Partial *w, const char *word,
+                                       int len)
+{
+    memcpy(w->word, word, len + 1);
+    w->map[0] = 0;
+    w->len = len;
+    w->checked = 0;
+
+    PORTER_Measure(w->word, &w->map[1]);
+    w->fixed = PORTER_fixed(&w->map[1], len, 0);
+
+    return;
+}
+
+/* Could two words part way through stemming still end up with one stem?
+ * Settled letters never change again, so each is only compared once. */
+static inline int PORTER_canMeet(PORTER_Partial *a, PORTER_Partial *b,
+                                 int reach)
+{
+    int ka, kb;
+    int n;
+
+    ka = PORTER_settled(a->fixed, a->len, reach);
+    kb = PORTER_settled(b->fixed, b->len, reach);
+    if (ka > b->len || kb > a->len) return 0;
+
+    n = (ka < kb) ? ka : kb;
+    for (; a->checked < n; a->checked++)
+    {
+        if (a->word[a->checked] != b->word[a->checked]) return 0;
+    }
+
+    return 1;
+}
+
+/* Could a word part way through stemming still end up as stem? */
+static inline int PORTER_canReach(PORTER_Partial *w, int reach,
+                                  const char *stem, int stemlen)
+{
+    int k;
+
+    k = PORTER_settled(w->fixed, w->len, reach);
+    if (stemlen > w->len || stemlen < k) return 0;
+
+    for (; w->checked < k; w->checked++)
+    {
+        if (w->word[w->checked] != stem[w->checked]) return 0;
+    }
+
+    return 1;
+}
+
+/* Take a word through step 1, after which more of it is settled. */
+static inline void PORTER_step1(PORTER_Partial *w)
+{
+    w->len = PORTER_step1a(w->word, w->len, &w->map[1]);
+    w->len = PORTER_step1b(w->word, w->len, &w->map[1]);
+    w->len = PORTER_step1c(w->word, w->len, &w->map[1]);
+    w->fixed = PORTER_fixed(&w->map[1], w->len, 1);
+
+    return;
+}
+
+static inline void PORTER_step23(PORTER_Partial *w)
+{
+    w->len = PORTER_step2(w->word, w->len, &w->map[1]);
+    w->len = PORTER_step3(w->word, w->len, &w->map[1]);
+    return;
+}
+
+static inline void PORTER_step45(PORTER_Partial *w)
+{
+    w->len = PORTER_step4(w->word, w->len, &w->map[1]);
+    w->len = PORTER_step5a(w->word, w->len, &w->map[1]);
+    w->len = PORTER_step5b(w->word, w->len, &w->map[1]);
+    return;
+}
+
+int PORTER_SameStem(const char *a, const char *b)
+{
+    PORTER_Partial pa, pb;
+    int alen, blen;
+
+    alen = PORTER_length(a);
+    blen = PORTER_length(b);
+
+    /* a word which isn't stemmed is its own stem */
+    if (!PORTER_valid(a, alen) || !PORTER_valid(b, blen))
+        return strcmp(PORTER_stemOf(a, alen, pa.word),
+                      PORTER_stemOf(b, blen, pb.word)) == 0;
+
+    PORTER_startPartial(&pa, a, alen);
+    PORTER_startPartial(&pb, b, blen);
+
+    /* step the two together, giving up as soon as they differ in letters
+     * which no step still to come can change.  Most pairs which differ do
+     * so in letters settled from the start or after step 1; checking after
+     * every step costs more than it saves. */
+    if (!PORTER_canMeet(&pa, &pb, PORTER_REACH)) return 0;
+
+    PORTER_step1(&pa);
+    PORTER_step1(&pb);
+    if (!PORTER_canMeet(&pa, &pb, PORTER_REACH1)) return 0;
+
+    PORTER_step23(&pa);
+    PORTER_step23(&pb);
+    if (!PORTER_canMeet(&pa, &pb, PORTER_REACH3)) return 0;
+
+    PORTER_step45(&pa);
+    PORTER_step45(&pb);
+    return PORTER_canMeet(&pa, &pb, 0);
+}
+
+size_t PORTER_SameStemBatch(const char *query, const char *const *words,
+                            size_t n, uint8_t *same)
+{
+    PORTER_Partial w;
+    char buf[PORTER_MAXWORD + 1];
+    const char *stem;
+    size_t matches;
+    size_t i;
+    int stemlen;
+    int len;
+
+    /* the query is stemmed once, and each word only as far as it takes to
+     * tell whether it can still arrive at the query's stem */
+    stem = PORTER_stemOf(query, PORTER_length(query), buf);
+    stemlen = strlen(stem);
+    matches = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        len = PORTER_length(words[i]);
+        same[i] = 0;
+
+        if (!PORTER_valid(words[i], len))
+        {
+            same[i] = (strcmp(words[i], stem) == 0);
+            matches += same[i];
+            continue;
+        }
+
+        PORTER_startPartial(&w, words[i], len);
+        if (!PORTER_canReach(&w, PORTER_REACH, stem, stemlen)) continue;
+
+        PORTER_step1(&w);
+        if (!PORTER_canReach(&w, PORTER_REACH1, stem, stemlen)) continue;
+
+        PORTER_step23(&w);
+        if (!PORTER_canReach(&w, PORTER_REACH3, stem, stemlen)) continue;
+
+        PORTER_step45(&w);
+        same[i] = PORTER_canReach(&w, 0, stem, stemlen);
+        matches += same[i];
+    }
+
+    return matches;
+}
+
+/* Words are bucketed a batch at a time, small enough for the order to sit
+ * on the stack and for the batch's words to stay in cache. */
+#define PORTER_BATCH     4096
+#define PORTER_LENCLASS  4
+#define PORTER_BUCKETS   (27 * PORTER_LENCLASS)
+
+/* The bucket of a word: its last letter (or 26 for anything else) and a
+ * class of its length, split where the rules' length guards fall. */
+static inline uint8_t PORTER_bucket(const char *word, size_t len)
+{
+    int c;
+    int lc;
+
+    c = toupper((unsigned char)word[len - 1]);
+    c = (c >= 'A' && c <= 'Z') ? c - 'A' : 26;
+
+    if (len <= 4) lc = 0;
+    else if (len <= 6) lc = 1;
+    else if (len <= 8) lc = 2;
+    else lc = 3;
+
+    return c * PORTER_LENCLASS + lc;
+}
+
+/* Stem up to PORTER_BATCH words in order of bucket, found by a counting
+ * sort.  Words are stemmed where they lie, so nothing has to be put back.
+ */
+static size_t PORTER_stemBucketed(char **words, size_t n)
+{
+    uint16_t order[PORTER_BATCH];
+    uint8_t key[PORTER_BATCH];
+    uint16_t start[PORTER_BUCKETS + 1];
+    size_t stemmed;
+    size_t len;
+    size_t i;
+    int b;
+
+    memset(start, 0x00, sizeof(start));
+
+    for (i = 0; i < n; i++)
+    {
+        len = PORTER_length(words[i]);
+        key[i] = (len > 0) ? PORTER_bucket(words[i], len) : 0;
+        start[key[i] + 1]++;
+    }
+
+    for (b = 0; b < PORTER_BUCKETS; b++) start[b + 1] += start[b];
+    for (i = 0; i < n; i++) order[start[key[i]]++] = i;
+
+    stemmed = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (PORTER_Stem(words[order[i]]) == 0) stemmed++;
+    }
+
+    return stemmed;
+}
+
+size_t PORTER_StemBatch(char **words, size_t n, int flags)
+{
+    size_t stemmed;
+    size_t i;
+    size_t m;
+
+    stemmed = 0;
+
+    if (!(flags & PORTER_BATCH_BUCKET))
+    {
+        for (i = 0; i < n; i++)
+        {
+            if (PORTER_Stem(words[i]) == 0) stemmed++;
+        }
+
+        return stemmed;
+    }
+
+    for (i = 0; i < n; i += m)
+    {
+        m = (n - i < PORTER_BATCH) ? n - i : PORTER_BATCH;
+        stemmed += PORTER_stemBucketed(&words[i], m);
+    }
+
+    return stemmed;
+}
+
+/* Uppercase a word in place, as measuring it would. */
+static inline void PORTER_upper(char *word)
+{
+    int i;
+
+    for (i = 0; word[i] != '\0'; i++) word[i] = toupper(word[i]);
+    return;
+}
+
+int PORTER_StemS(char *word)
+{
+    int len;
+
+    len = PORTER_length(word);
+    if (!PORTER_valid(word, len)) return -1;
+    PORTER_upper(word);
+
+    /* IES -> Y, but not after A or E */
+    if (len > 3 && PORTER_endsWith(word, len, "IES", 3))
+    {
+        if (word[len - 4] != 'A' && word[len - 4] != 'E')
+        {
+            word[len - 3] = 'Y';
+            word[len - 2] = '\0';
+        }
+
+        return 0;
+    }
+
+    /* ES -> E, but not after A, E or O */
+    if (len > 2 && PORTER_endsWith(word, len, "ES", 2))
+    {
+        if (word[len - 3] != 'A' && word[len - 3] != 'E' &&
+            word[len - 3] != 'O')
+            word[len - 1] = '\0';
+
+        return 0;
+    }
+
+    /* S -> , but not after U or S */
+    if (len > 1 && word[len - 1] == 'S')
+    {
+        if (word[len - 2] != 'U' && word[len - 2] != 'S')
+            word[len - 1] = '\0';
+    }
+
+    return 0;
+}
+
+int PORTER_StemStep1(char *word)
+{
+    int len;
+    uint8_t map[PORTER_MAXWORD + 1];
+
+    len = PORTER_length(word);
+    if (!PORTER_valid(word, len)) return -1;
+    PORTER_upper(word);
+
+    /* step 1a only looks at letters; the rest of step 1 only has anything
+     * to do to words ending in -ED, -ING or -Y, so only those are measured
+     */
     len = PORTER_step1a(word, len, map);
-    len = PORTER_step1b(word, len, map);
-    len = PORTER_step1c(word, len, map);
-    len = PORTER_step2(word, len, map);
-    len = PORTER_step3(word, len, map);
-    len = PORTER_step4(word, len, map);
-    len = PORTER_step5a(word, len, map);
-    PORTER_step5b(word, len, map);          /* don't keep final length... */
+    if (len < 1) return 0;
+
+    if (word[len - 1] == 'Y' || PORTER_endsWith(word, len, "ED", 2) ||
+        PORTER_endsWith(word, len, "ING", 3))
+    {
+        PORTER_Measure(word, map);
+        len = PORTER_step1b(word, len, map);
+        PORTER_step1c(word, len, map);
+    }
+
+    return 0;
+}
+
+int PORTER_StemLevel(char *word, int level)
+{
+    switch (level)
+    {
+        case PORTER_LEVEL_S:
+            return PORTER_StemS(word);
+
+        case PORTER_LEVEL_STEP1:
+            return PORTER_StemStep1(word);
+
+        case PORTER_LEVEL_FULL:
+            return PORTER_Stem(word);
+    }
+
+    return -1;
+}
+
+/* Hash the stem of a word into *hash, returning 0 if it was stemmed and -1
+ * if it was hashed as it is. */
+static int PORTER_stemHash(const char *w, size_t n, uint64_t seed,
+                           uint64_t *hash)
+{
+    char word[PORTER_MAXWORD + 1];
+    int len;
+
+    /* words which can't be stemmed hash as they are */
+    if (!PORTER_valid(w, n))
+    {
+        *hash = PORTER_Hash(w, n, seed);
+        return -1;
+    }
+
+    /* the stem only ever lives here, on the stack, and is hashed straight
+     * from it at the length the rules leave it */
+    memcpy(word, w, n);
+    word[n] = '\0';
+
+    len = PORTER_stemWord(word, n);
+    *hash = PORTER_Hash(word, len, seed);
+
+    return 0;
+}
+
+uint64_t PORTER_StemHash(const char *w, size_t n, uint64_t seed)
+{
+    uint64_t hash;
+
+    PORTER_stemHash(w, n, seed, &hash);
+    return hash;
+}
+
+size_t PORTER_StemHashBatch(const char *const *words, const size_t *lens,
+                            size_t n, uint64_t seed, uint64_t *hashes)
+{
+    size_t stemmed;
+    size_t len;
+    size_t i;
+
+    stemmed = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        /* a terminated word is only read to its end if it is too long to
+         * stem, and so has to be hashed whole */
+        if (lens != NULL) len = lens[i];
+        else
+        {
+            len = PORTER_length(words[i]);
+            if (len > PORTER_MAXWORD) len += strlen(words[i] + len);
+        }
+
+        if (PORTER_stemHash(words[i], len, seed, &hashes[i]) == 0)
+            stemmed++;
+    }
+
+    return stemmed;
+}
+
+int PORTER_StemPatch(const char *w, size_t n, PORTER_Patch *patch)
+{
+    char word[PORTER_MAXWORD + 1];
+    int keep;
+    int len;
+
+    if (!PORTER_valid(w, n))
+    {
+        patch->keep = 0;
+        patch->len = PORTER_PATCH_NONE;
+        return -1;
+    }
+
+    /* the steps rewrite the word as they go, so it is stemmed in full in a
+     * copy and compared with the original after, rather than each rule
+     * reporting where it cut: simpler, and a patch is for storage */
+    memcpy(word, w, n);
+    word[n] = '\0';
+
+    len = PORTER_stemWord(word, n);
+
+    /* the stem parts from the (upper-cased) word only where the last rule
+     * to replace a suffix (rather than just remove one) wrote: steps 1a-1c
+     * write at most one byte, and each step 2 rule's replacement (of four
+     * bytes at most) covers all they wrote; steps 3-5 only ever remove */
+    for (keep = 0; keep < len; keep++)
+    {
+        if (word[keep] != toupper((unsigned char)w[keep])) break;
+    }
+
+    patch->keep = keep;
+    patch->len = len - keep;
+    memcpy(patch->tail, word + keep, len - keep);
 
     return 0;
 }
+
+size_t PORTER_StemPatchBatch(const char *const *words, const size_t *lens,
+                             size_t n, PORTER_Patch *patches)
+{
+    size_t stemmed;
+    size_t len;
+    size_t i;
+
+    stemmed = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        len = (lens != NULL) ? lens[i] : PORTER_length(words[i]);
+        if (PORTER_StemPatch(words[i], len, &patches[i]) == 0) stemmed++;
+    }
+
+    return stemmed;
+}
+
+/* Byte i of the stem a patch describes, or of the word itself if it has
+ * none. */
+static inline unsigned char PORTER_patchByte(const char *w,
+                                             const PORTER_Patch *p, size_t i)
+{
+    if (p->len == PORTER_PATCH_NONE) return w[i];
+    if (i < p->keep) return toupper((unsigned char)w[i]);
+    return p->tail[i - p->keep];
+}
+
+size_t PORTER_PatchLength(size_t n, const PORTER_Patch *p)
+{
+    return (p->len == PORTER_PATCH_NONE) ? n : (size_t)p->keep + p->len;
+}
+
+size_t PORTER_PatchString(const char *w, size_t n, const PORTER_Patch *p,
+                          char *out)
+{
+    size_t len;
+    size_t i;
+
+    len = PORTER_PatchLength(n, p);
+    for (i = 0; i < len; i++) out[i] = PORTER_patchByte(w, p, i);
+    out[len] = '\0';
+
+    return len;
+}
+
+int PORTER_PatchCompare(const char *a, size_t na, const PORTER_Patch *pa,
+                        const char *b, size_t nb, const PORTER_Patch *pb)
+{
+    unsigned char ca;
+    unsigned char cb;
+    size_t la;
+    size_t lb;
+    size_t i;
+
+    la = PORTER_PatchLength(na, pa);
+    lb = PORTER_PatchLength(nb, pb);
+
+    for (i = 0; i < la && i < lb; i++)
+    {
+        ca = PORTER_patchByte(a, pa, i);
+        cb = PORTER_patchByte(b, pb, i);
+        if (ca != cb) return (ca < cb) ? -1 : 1;
+    }
+
+    if (la == lb) return 0;
+    return (la < lb) ? -1 : 1;
+}
+
+uint64_t PORTER_PatchHash(const char *w, size_t n, const PORTER_Patch *p,
+                          uint64_t seed)
+{
+    char stem[PORTER_MAXWORD + 1];
+
+    if (p->len == PORTER_PATCH_NONE) return PORTER_Hash(w, n, seed);
+
+    return PORTER_Hash(stem, PORTER_PatchString(w, n, p, stem), seed);
+}
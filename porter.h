@@ -1,6 +1,497 @@
 #ifndef _PORTER_H
 #define _PORTER_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returned (in place of a stem) when a word is a stopword. */
+#define PORTER_STOPWORD 1
+
+/* The longest word which is stemmed.  Words which are longer, or empty, or
+ * not all ASCII letters, are left as they are by every function here. */
+#define PORTER_MAXWORD  31
+
+/** Stem a word in place.  The stem is uppercase.  A word which can't be
+ *  stemmed is turned away after at most PORTER_MAXWORD + 1 of its bytes
+ *  have been read, so the cost of a word is bounded whatever its size.
+ *
+ *  @return 0 on success, -1 if the word can't be stemmed.
+ */
 int PORTER_Stem(char *word);
 
+/** Can a word be stemmed: is it 1 to PORTER_MAXWORD bytes long, and all
+ *  ASCII letters (whatever the locale)?  This is the test every function
+ *  here applies.
+ *
+ *  @param w  the word, which need not be terminated.
+ *  @param n  the length of the word.
+ *  @return 1 if so, 0 if not.
+ */
+int PORTER_IsWord(const char *w, size_t n);
+
+/** State carried between adjacent words by PORTER_StemPrefix().  Zero it
+ *  before the first word; its contents are otherwise private.
+ */
+typedef struct
+{
+    char raw[PORTER_MAXWORD + 1];
+    char word[PORTER_MAXWORD + 1];
+    uint8_t map[PORTER_MAXWORD + 1];
+    int len;
+} PORTER_Prefix;
+
+/* Stemming levels, from the lightest to the full algorithm.  A level is a
+ * fixed function of the word alone, so stems made at index time and at
+ * query time agree as long as both use the same level. */
+#define PORTER_LEVEL_S      1   /* plurals only (Harman's S-stemmer) */
+#define PORTER_LEVEL_STEP1  2   /* Porter's step 1: plurals, -ed and -ing */
+#define PORTER_LEVEL_FULL   3   /* every step, as PORTER_Stem() */
+
+/** Stem a word with one of the S-stemmer's three rules (-ies to -y, -es to
+ *  -e, -s to nothing).  No measure is taken.  Like PORTER_Stem(), the
+ *  result is uppercase.
+ *
+ *  @return 0 on success, -1 if the word can't be stemmed.
+ */
+int PORTER_StemS(char *word);
+
+/** Apply only step 1 (1a to 1c) of the Porter algorithm to a word; the
+ *  result is the word as PORTER_Stem() has it after step 1.  The word is
+ *  measured only if it ends in -ed, -ing or -y.
+ */
+int PORTER_StemStep1(char *word);
+
+/** Stem a word at a level (PORTER_LEVEL_S, PORTER_LEVEL_STEP1 or
+ *  PORTER_LEVEL_FULL).
+ *
+ *  @return 0 on success, -1 if the word can't be stemmed or the level is
+ *          unknown.
+ */
+int PORTER_StemLevel(char *word, int level);
+
+/** Stem a word, measuring only from the first letter which differs from
+ *  the previous word stemmed with the same state.  The result is identical
+ *  to PORTER_Stem(), but much less work when adjacent words share long
+ *  prefixes (as in a sorted vocabulary).
+ */
+int PORTER_StemPrefix(char *word, PORTER_Prefix *prev);
+
+/** Stem a batch of words with PORTER_StemPrefix(); for sorted input.
+ *
+ *  @return the number of words stemmed.
+ */
+size_t PORTER_StemSorted(char **words, size_t n);
+
+/** Check whether two words have the same stem (as PORTER_Stem() gives
+ *  it), without changing either.  The words are stemmed side by side, and
+ *  the answer is given as soon as they differ in letters which no step
+ *  still to come could reach, which is usually well before the end.
+ *
+ *  @return 1 if the stems are the same, 0 if not.
+ */
+int PORTER_SameStem(const char *a, const char *b);
+
+/** Check which of a batch of words have the same stem as query.  The
+ *  query is stemmed once; each word only until it can no longer come to
+ *  the query's stem.
+ *
+ *  @param same  receives 1 for each word with the query's stem, else 0.
+ *
+ *  @return the number of words with the query's stem.
+ */
+size_t PORTER_SameStemBatch(const char *query, const char *const *words,
+                            size_t n, uint8_t *same);
+
+/* Flags for PORTER_StemBatch(). */
+#define PORTER_BATCH_BUCKET  1  /* stem in order of last letter and length */
+
+/** Stem a batch of words in place (stopwords included; see
+ *  PORTER_Stopwords).  With PORTER_BATCH_BUCKET, each run of a few
+ *  thousand words is stemmed grouped by last letter and length class
+ *  (found by a counting sort), so that the rules' branches on both are
+ *  taken alike many times in a row; the words themselves stay where they
+ *  are, and the stems are identical either way.
+ *
+ *  @return the number of words stemmed.
+ */
+size_t PORTER_StemBatch(char **words, size_t n, int flags);
+
+/** The 64-bit hash used by PORTER_StemHash(), of len bytes at p.  It is
+ *  the same on every host.
+ */
+uint64_t PORTER_Hash(const char *p, size_t len, uint64_t seed);
+
+/** Hash the stem of a word without writing the stem out: the result is
+ *  PORTER_Hash() of the bytes PORTER_Stem() would leave in the word.  A
+ *  word which can't be stemmed (see PORTER_MAXWORD) is hashed as it is.
+ *
+ *  @param w     the word, which need not be terminated.
+ *  @param n     the length of the word.
+ *  @param seed  the hash seed; different seeds give independent hashes.
+ */
+uint64_t PORTER_StemHash(const char *w, size_t n, uint64_t seed);
+
+/** Hash the stems of a batch of words with PORTER_StemHash().
+ *
+ *  @param words   the words.
+ *  @param lens    the length of each word, or NULL if they are terminated.
+ *  @param n       the number of words.
+ *  @param seed    the hash seed.
+ *  @param hashes  receives the n hashes.
+ *
+ *  @return the number of words stemmed (the rest are hashed unchanged).
+ */
+size_t PORTER_StemHashBatch(const char *const *words, const size_t *lens,
+                            size_t n, uint64_t seed, uint64_t *hashes);
+
+/* A stem is always the upper-cased word cut short, then perhaps a few
+ * bytes of replacement ("HAPPY" gives "HAPP" and "I"), and can be
+ * described by a patch against the word, so that callers keeping the words
+ * need not keep a copy of each stem too.  The bytes kept are read from the
+ * word as it is, so the helpers below upper-case them. */
+#define PORTER_PATCH_TAIL  4
+#define PORTER_PATCH_NONE  0xff   /* as len: the word can't be stemmed */
+
+typedef struct
+{
+    uint8_t keep;                   /* leading bytes of the word kept */
+    uint8_t len;                    /* bytes of tail, or PORTER_PATCH_NONE */
+    char tail[PORTER_PATCH_TAIL];   /* what follows them in the stem */
+} PORTER_Patch;
+
+/** Stem a word into a patch, without writing the stem over the word.  A
+ *  word which can't be stemmed (see PORTER_MAXWORD) is its own stem, as it
+ *  is (not upper-cased), and gets a patch of length PORTER_PATCH_NONE.
+ *  The word is stemmed in a copy, so this costs a little more than
+ *  PORTER_Stem(); a patch saves space, not time.
+ *
+ *  @param w      the word, which need not be terminated.
+ *  @param n      the length of the word.
+ *  @param patch  receives the patch.
+ *  @return 0, or -1 if the word can't be stemmed.
+ */
+int PORTER_StemPatch(const char *w, size_t n, PORTER_Patch *patch);
+
+/** Stem a batch of words into patches with PORTER_StemPatch().
+ *
+ *  @param words    the words.
+ *  @param lens     the length of each word, or NULL if they are terminated.
+ *  @param n        the number of words.
+ *  @param patches  receives the n patches.
+ *
+ *  @return the number of words stemmed.
+ */
+size_t PORTER_StemPatchBatch(const char *const *words, const size_t *lens,
+                             size_t n, PORTER_Patch *patches);
+
+/** The length of the stem a patch describes against a word of length n. */
+size_t PORTER_PatchLength(size_t n, const PORTER_Patch *p);
+
+/** Write out the stem a patch describes (as PORTER_Stem() would leave it)
+ *  and terminate it; out needs room for PORTER_PatchLength() + 1 bytes.
+ *
+ *  @return the length of the stem.
+ */
+size_t PORTER_PatchString(const char *w, size_t n, const PORTER_Patch *p,
+                          char *out);
+
+/** Compare two stems, each given as a word and its patch, as memcmp()
+ *  would compare the stems written out (the shorter first if one is a
+ *  prefix of the other).  A stem already written out compares as a word
+ *  with the patch { 0, PORTER_PATCH_NONE }.
+ */
+int PORTER_PatchCompare(const char *a, size_t na, const PORTER_Patch *pa,
+                        const char *b, size_t nb, const PORTER_Patch *pb);
+
+/** Hash the stem a patch describes; this is PORTER_StemHash() of the word
+ *  with the same seed. */
+uint64_t PORTER_PatchHash(const char *w, size_t n, const PORTER_Patch *p,
+                          uint64_t seed);
+
+/** A batch of packed words split into tasks, for callers with thread pools
+ *  of their own: the library starts no threads.  Each task is run (on any
+ *  thread, in any order) with PORTER_PlanRun(), and the plan is finished,
+ *  once, after all have run.  Tasks share nothing but the read-only plan,
+ *  and need no scratch beyond a few dozen bytes of stack.
+ */
+typedef struct PORTER_Plan PORTER_Plan;
+
+/** One task of a plan: a run of words, and its estimated cost (the bytes
+ *  stemming them touches). */
+typedef struct
+{
+    size_t first;
+    size_t n;
+    size_t cost;
+} PORTER_Task;
+
+/** Plan the stemming of a packed batch of words: word i is the bytes of
+ *  arena from offsets[i] to offsets[i + 1].  The batch is split into tasks
+ *  of about equal cost, each near grain; the default keeps a task's words,
+ *  stems and offsets within a typical L1 cache.  The arrays are kept, not
+ *  copied, and must outlive the plan.
+ *
+ *  @param arena    the words.
+ *  @param offsets  the n + 1 offsets of the words, ascending.
+ *  @param n        the number of words.
+ *  @param out      receives the stems, packed, when the plan is finished;
+ *                  it needs room for offsets[n] bytes, and may be the
+ *                  arena itself.
+ *  @param stems    receives the n + 1 offsets of the stems in out (it
+ *                  must not be offsets).
+ *  @param grain    the cost to aim for per task, or 0 for the default.
+ *
+ *  @return the plan, or NULL on failure.
+ */
+PORTER_Plan *PORTER_PlanCreate(const char *arena, const size_t *offsets,
+                               size_t n, char *out, size_t *stems,
+                               size_t grain);
+
+void PORTER_PlanFree(PORTER_Plan *plan);
+
+size_t PORTER_PlanTasks(const PORTER_Plan *plan);
+
+const PORTER_Task *PORTER_PlanTask(const PORTER_Plan *plan, size_t task);
+
+/** Run one task of a plan.  Different tasks may run at once.  Words which
+ *  can't be stemmed (see PORTER_MAXWORD) are passed on as they are.
+ *
+ *  @return the number of words stemmed.
+ */
+size_t PORTER_PlanRun(const PORTER_Plan *plan, size_t task);
+
+/** Finish a plan once every task has run, packing the stems into the
+ *  start of out and filling in stems.
+ *
+ *  @return the length of the packed stems.
+ */
+size_t PORTER_PlanFinish(PORTER_Plan *plan);
+
+/** A set of stopwords, compiled into a perfect hash.  Stopwords are only
+ *  passed over by PORTER_StemStop(), PORTER_InvIndexBuild() and the porter
+ *  command; the batch, hash, patch and plan functions stem every word, so
+ *  callers of those drop stopwords themselves (with PORTER_IsStopword()).
+ */
+typedef struct PORTER_Stopwords PORTER_Stopwords;
+
+/** Build a stopword set from a list of words.
+ *
+ *  @param words  the stopwords (in any case), or NULL for the built-in
+ *                English list.
+ *  @param n      the number of words.
+ *
+ *  @return the set, or NULL on failure.
+ */
+PORTER_Stopwords *PORTER_StopwordsCreate(const char *const *words, size_t n);
+
+/** Build a stopword set from a file of one word per line.  Blank lines and
+ *  anything following a '#' are ignored, as is anything on a line beyond
+ *  its first word.
+ */
+PORTER_Stopwords *PORTER_StopwordsLoad(const char *path);
+
+void PORTER_StopwordsFree(PORTER_Stopwords *sw);
+
+/** Check whether the first len bytes of word are a stopword (in any case).
+ */
+int PORTER_IsStopword(const PORTER_Stopwords *sw, const char *word,
+                      size_t len);
+
+/** Stem a word unless it is a stopword, in which case the word is left
+ *  untouched and PORTER_STOPWORD is returned.  If sw is NULL, this is
+ *  PORTER_Stem().  A word longer than PORTER_MAXWORD is turned away (with
+ *  -1) after PORTER_MAXWORD + 1 of its bytes, before it is looked up.
+ */
+int PORTER_StemStop(char *word, const PORTER_Stopwords *sw);
+
+/** A reverse index, from each stem to the surface forms which produced it.
+ */
+typedef struct PORTER_RevIndex PORTER_RevIndex;
+
+/** Stem a list of words (using nthreads threads) and write the reverse
+ *  index of the result to path.  Duplicate forms are dropped.
+ *
+ *  @return 0 on success, -1 on failure.
+ */
+int PORTER_RevIndexBuild(const char *const *words, size_t n, int nthreads,
+                         const char *path);
+
+/** Map a reverse index written by PORTER_RevIndexBuild() into memory. */
+PORTER_RevIndex *PORTER_RevIndexOpen(const char *path);
+
+void PORTER_RevIndexClose(PORTER_RevIndex *ri);
+
+/** Find the surface forms of a stem (which need not be terminated).  No
+ *  memory is allocated; each entry of *forms is resolved to a string with
+ *  PORTER_RevIndexForm().
+ *
+ *  @return the number of forms (0 if the stem is not in the index).
+ */
+size_t PORTER_RevIndexLookup(const PORTER_RevIndex *ri, const char *stem,
+                             size_t len, const uint64_t **forms);
+
+const char *PORTER_RevIndexForm(const PORTER_RevIndex *ri, uint64_t form);
+
+size_t PORTER_RevIndexStems(const PORTER_RevIndex *ri);
+size_t PORTER_RevIndexForms(const PORTER_RevIndex *ri);
+
+/** An inverted index, from each stem to the documents containing it. */
+typedef struct PORTER_InvIndex PORTER_InvIndex;
+
+/** A cursor over the postings of one stem. */
+typedef struct
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    uint64_t doc;
+} PORTER_Postings;
+
+/** Tokenize and stem a list of documents (using nthreads threads) and
+ *  write the inverted index of the result to path.  Documents are numbered
+ *  from 0 in the order given; every alphabetic run within a document is a
+ *  token, and stopwords found in stop (if it is not NULL) are left out.
+ *
+ *  @param docs      the documents.
+ *  @param lens      the length of each document, or NULL if they are
+ *                   terminated.
+ *  @param n         the number of documents.
+ *  @param nthreads  the number of threads to build with.
+ *  @param stop      stopwords to leave out, or NULL.
+ *  @param path      the file to write.
+ *
+ *  @return 0 on success, -1 on failure.
+ */
+int PORTER_InvIndexBuild(const char *const *docs, const size_t *lens,
+                         size_t n, int nthreads,
+                         const PORTER_Stopwords *stop, const char *path);
+
+/** Map an inverted index written by PORTER_InvIndexBuild() into memory. */
+PORTER_InvIndex *PORTER_InvIndexOpen(const char *path);
+
+void PORTER_InvIndexClose(PORTER_InvIndex *ix);
+
+/** Find the postings of a stem (which need not be terminated), and set it
+ *  to walk them with PORTER_PostingsNext().  No memory is allocated.
+ *
+ *  @return the number of documents containing the stem (0 if none).
+ */
+size_t PORTER_InvIndexLookup(const PORTER_InvIndex *ix, const char *stem,
+                             size_t len, PORTER_Postings *it);
+
+/** Decode the next document number of a stem's postings.
+ *
+ *  @return 1 if *doc was set, 0 at the end of the postings.
+ */
+int PORTER_PostingsNext(PORTER_Postings *it, uint64_t *doc);
+
+size_t PORTER_InvIndexDocs(const PORTER_InvIndex *ix);
+size_t PORTER_InvIndexTerms(const PORTER_InvIndex *ix);
+
+/** A stem cache in named shared memory, shared by every process which
+ *  opens it.
+ */
+typedef struct PORTER_Cache PORTER_Cache;
+
+/** Counters of a stem cache, summed over every process using it. */
+typedef struct
+{
+    uint64_t slots;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t busy;        /* inserts dropped as another writer held a slot */
+    uint64_t recovered;   /* slots taken over from writers which died */
+} PORTER_CacheCounts;
+
+/** Open (creating it if need be) the shared stem cache called name (a
+ *  POSIX shared memory name, such as "/porter").
+ *
+ *  @param name   the segment's name.
+ *  @param slots  the number of entries, if the cache is created (rounded
+ *                up to a power of two; 0 for the default of 65536).
+ *                Otherwise the cache keeps the size it was created with.
+ *
+ *  @return the cache, or NULL on failure.
+ */
+PORTER_Cache *PORTER_CacheOpen(const char *name, size_t slots);
+
+/** Close a cache; it persists (with its contents) until unlinked. */
+void PORTER_CacheClose(PORTER_Cache *c);
+
+int PORTER_CacheUnlink(const char *name);
+
+/** Stem a word as PORTER_Stem() does, taking the stem from the cache if it
+ *  is there and adding it to the cache if not.  Lookups never block, and
+ *  the same handle may be used by several threads.
+ */
+int PORTER_StemCached(char *word, PORTER_Cache *c);
+
+void PORTER_CacheStats(PORTER_Cache *c, PORTER_CacheCounts *counts);
+
+/** A fixed-size summary of a stream of stems: a HyperLogLog counter of the
+ *  distinct stems and a Space-Saving table of the most frequent ones.
+ *  Sketches of the same capacity can be merged, so each thread can keep
+ *  its own and combine them at the end.
+ */
+typedef struct PORTER_Sketch PORTER_Sketch;
+
+/** One of the most frequent stems.  The stem occurred between count -
+ *  error and count times.
+ */
+typedef struct
+{
+    char stem[PORTER_MAXWORD + 1];
+    uint64_t count;
+    uint64_t error;
+} PORTER_TopStem;
+
+/** Create a sketch tracking the k most frequent stems (the distinct count
+ *  uses a further 16KB, whatever k is).
+ *
+ *  @return the sketch, or NULL on failure.
+ */
+PORTER_Sketch *PORTER_SketchCreate(size_t k);
+
+void PORTER_SketchFree(PORTER_Sketch *s);
+
+size_t PORTER_SketchCapacity(const PORTER_Sketch *s);
+
+/** Add one occurrence of a stem (which need not be terminated, and is
+ *  truncated to PORTER_MAXWORD bytes) to a sketch.
+ */
+void PORTER_SketchAdd(PORTER_Sketch *s, const char *stem, size_t len);
+
+/** Merge src into dst, as if everything added to src had been added to
+ *  dst.  Frequent stems are merged as mergeable Space-Saving summaries are,
+ *  so the bounds given by PORTER_SketchTop() still hold.
+ *
+ *  @return 0 on success, -1 if the capacities differ or memory could not
+ *          be allocated.
+ */
+int PORTER_SketchMerge(PORTER_Sketch *dst, const PORTER_Sketch *src);
+
+/** The number of stems added (counting repeats). */
+uint64_t PORTER_SketchTotal(const PORTER_Sketch *s);
+
+/** Estimate the number of distinct stems added (to within about 1%). */
+uint64_t PORTER_SketchDistinct(const PORTER_Sketch *s);
+
+/** Find the most frequent stems, most frequent first.
+ *
+ *  @param top  receives up to n stems.
+ *
+ *  @return the number of stems stored in top.
+ */
+size_t PORTER_SketchTop(const PORTER_Sketch *s, PORTER_TopStem *top,
+                        size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,420 @@
+#ifndef _PORTER_HPP
+#define _PORTER_HPP
+
+/* A C++20 layer over the stemmer, for token pipelines built from ranges:
+ *
+ *   porter::views::tokens   splits text into its alphabetic runs
+ *   porter::views::stem     stems each word of a range of words
+ *   porter::stems()         a coroutine stemming text arriving in chunks
+ *
+ * None of them allocates per word.  A stem is written into a buffer held
+ * by the iterator (or by the coroutine) which produced it, and the
+ * std::string_view handed out refers to that buffer, so it is only valid
+ * until the iterator is next advanced; copy it to keep it.  For the same
+ * reason stem_view is an input range (it can be traversed once).
+ *
+ * Words which PORTER_Stem() won't stem (empty, or longer than max_word
+ * letters) are passed through as they are, except by stems(), which skips
+ * words too long to stem (it holds no more of a word than that).
+ */
+
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <ranges>
+#include <string_view>
+#include <utility>
+
+#include "porter.h"
+
+namespace porter
+{
+
+/** The longest word which is stemmed. */
+inline constexpr std::size_t max_word = PORTER_MAXWORD;
+
+/** A stemmer with a buffer of its own, for stemming one word at a time
+ *  without touching the caller's copy.
+ */
+class stemmer
+{
+public:
+    /** Stem a word.  The result stays valid until the next call. */
+    std::string_view operator()(std::string_view word) noexcept
+    {
+        if (word.empty() || word.size() > max_word) return word;
+
+        std::memcpy(buf_, word.data(), word.size());
+        buf_[word.size()] = '\0';
+        PORTER_Stem(buf_);
+
+        return std::string_view(buf_, std::strlen(buf_));
+    }
+
+private:
+    char buf_[max_word + 1];
+};
+
+/** A view of the alphabetic runs in a piece of text. */
+class tokens_view : public std::ranges::view_interface<tokens_view>
+{
+public:
+    class iterator
+    {
+    public:
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using iterator_concept = std::forward_iterator_tag;
+
+        iterator() = default;
+
+        iterator(std::string_view text, std::size_t pos) : text_(text)
+        {
+            next(pos);
+        }
+
+        std::string_view operator*() const
+        {
+            return text_.substr(start_, end_ - start_);
+        }
+
+        iterator &operator++()
+        {
+            next(end_);
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator it = *this;
+            ++*this;
+            return it;
+        }
+
+        bool operator==(const iterator &o) const
+        {
+            return start_ == o.start_;
+        }
+
+        bool operator==(std::default_sentinel_t) const
+        {
+            return start_ == text_.size();
+        }
+
+    private:
+        static bool alpha(char c)
+        {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        }
+
+        void next(std::size_t pos)
+        {
+            while (pos < text_.size() && !alpha(text_[pos])) pos++;
+            start_ = pos;
+            while (pos < text_.size() && alpha(text_[pos])) pos++;
+            end_ = pos;
+        }
+
+        std::string_view text_;
+        std::size_t start_ = 0;
+        std::size_t end_ = 0;
+    };
+
+    tokens_view() = default;
+    explicit tokens_view(std::string_view text) : text_(text) {}
+
+    iterator begin() const { return iterator(text_, 0); }
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+private:
+    std::string_view text_;
+};
+
+/** A view stemming each word of an underlying range of words (anything
+ *  convertible to std::string_view).  Each word is stemmed once, when its
+ *  element is first read.
+ */
+template <std::ranges::input_range V>
+    requires std::ranges::view<V> &&
+             std::convertible_to<std::ranges::range_reference_t<V>,
+                                 std::string_view>
+class stem_view : public std::ranges::view_interface<stem_view<V>>
+{
+public:
+    class iterator
+    {
+    public:
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using iterator_concept = std::input_iterator_tag;
+
+        iterator() = default;
+        explicit iterator(std::ranges::iterator_t<V> it) : it_(it) {}
+
+        /* the buffer is ours, so an iterator can't share it by copying */
+        iterator(iterator &&) = default;
+        iterator &operator=(iterator &&) = default;
+
+        std::string_view operator*() const
+        {
+            if (!ready_)
+            {
+                stem_ = stemmer_(std::string_view(*it_));
+                ready_ = true;
+            }
+
+            return stem_;
+        }
+
+        iterator &operator++()
+        {
+            ++it_;
+            ready_ = false;
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        friend bool operator==(const iterator &it,
+                               const std::ranges::sentinel_t<V> &end)
+        {
+            return it.it_ == end;
+        }
+
+    private:
+        std::ranges::iterator_t<V> it_;
+        mutable stemmer stemmer_;
+        mutable std::string_view stem_;
+        mutable bool ready_ = false;
+    };
+
+    stem_view() = default;
+    explicit stem_view(V base) : base_(std::move(base)) {}
+
+    iterator begin() { return iterator(std::ranges::begin(base_)); }
+    auto end() { return std::ranges::end(base_); }
+
+private:
+    V base_;
+};
+
+template <class R>
+stem_view(R &&) -> stem_view<std::views::all_t<R>>;
+
+namespace views
+{
+
+struct tokens_fn
+{
+    tokens_view operator()(std::string_view text) const
+    {
+        return tokens_view(text);
+    }
+};
+
+struct stem_fn
+{
+    template <std::ranges::viewable_range R>
+    auto operator()(R &&r) const
+    {
+        return stem_view(std::views::all(std::forward<R>(r)));
+    }
+
+    template <std::ranges::viewable_range R>
+    friend auto operator|(R &&r, const stem_fn &f)
+    {
+        return f(std::forward<R>(r));
+    }
+};
+
+/** text | porter::views::tokens is not supported (text is not a range of
+ *  words); call porter::views::tokens(text) to start a pipeline. */
+inline constexpr tokens_fn tokens;
+
+/** words | porter::views::stem, or porter::views::stem(words). */
+inline constexpr stem_fn stem;
+
+}
+
+/** A minimal generator (an input range over the values a coroutine
+ *  yields), as std::generator is not yet in every library.
+ */
+template <class T>
+class generator : public std::ranges::view_interface<generator<T>>
+{
+public:
+    struct promise_type
+    {
+        const T *value = nullptr;
+        std::exception_ptr error;
+
+        generator get_return_object()
+        {
+            return generator(handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        /* the yielded value lives in the coroutine until it resumes */
+        std::suspend_always yield_value(const T &v) noexcept
+        {
+            value = &v;
+            return {};
+        }
+
+        void return_void() noexcept {}
+        void unhandled_exception() { error = std::current_exception(); }
+
+        /* generators can't await anything */
+        template <class U>
+        std::suspend_never await_transform(U &&) = delete;
+    };
+
+    using handle = std::coroutine_handle<promise_type>;
+
+    class iterator
+    {
+    public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(handle h) : h_(h) {}
+
+        const T &operator*() const { return *h_.promise().value; }
+
+        iterator &operator++()
+        {
+            h_.resume();
+            if (h_.promise().error) std::rethrow_exception(h_.promise().error);
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const
+        {
+            return h_ == nullptr || h_.done();
+        }
+
+    private:
+        handle h_;
+    };
+
+    generator(generator &&o) noexcept : h_(std::exchange(o.h_, nullptr)) {}
+
+    generator &operator=(generator &&o) noexcept
+    {
+        if (this != &o)
+        {
+            if (h_) h_.destroy();
+            h_ = std::exchange(o.h_, nullptr);
+        }
+
+        return *this;
+    }
+
+    ~generator()
+    {
+        if (h_) h_.destroy();
+    }
+
+    iterator begin()
+    {
+        h_.resume();
+        if (h_.promise().error) std::rethrow_exception(h_.promise().error);
+        return iterator(h_);
+    }
+
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+private:
+    explicit generator(handle h) : h_(h) {}
+
+    handle h_;
+};
+
+/** Stem the words of text arriving in chunks (any range of things
+ *  convertible to std::string_view: blocks read from a socket, say).  A
+ *  word split between chunks is joined up.  One longer than max_word
+ *  letters can't be held whole, so is skipped (not yielded), wherever the
+ *  chunks happen to split it.  The coroutine's frame is allocated once,
+ *  and no allocation is made per word; each stem is only valid until the
+ *  generator is next advanced, and each chunk need only stay valid until
+ *  the generator asks for the next.
+ */
+template <std::ranges::input_range R>
+    requires std::convertible_to<std::ranges::range_reference_t<R>,
+                                 std::string_view>
+generator<std::string_view> stems(R chunks)
+{
+    stemmer stem;
+    char carry[max_word];
+    std::size_t ncarry = 0;
+    bool overlong = false;     /* the carried word is too long to keep */
+    std::string_view word;
+    std::size_t i, start, n;
+
+    auto alpha = [](char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    };
+
+    for (auto &&c : chunks)
+    {
+        std::string_view chunk(c);
+
+        for (i = 0; i < chunk.size(); )
+        {
+            start = i;
+            while (i < chunk.size() && alpha(chunk[i])) i++;
+            n = i - start;
+
+            /* a word running to the end of the chunk may carry on in the
+             * next, so it is held back (as is a carried one it ends) */
+            if (ncarry > 0 || overlong || i == chunk.size())
+            {
+                if (overlong || ncarry + n > max_word)
+                {
+                    overlong = true;
+                    ncarry = 0;
+                }
+                else
+                {
+                    std::memcpy(carry + ncarry, chunk.data() + start, n);
+                    ncarry += n;
+                }
+
+                if (i == chunk.size()) break;
+
+                n = ncarry;
+                ncarry = 0;
+                if (!std::exchange(overlong, false))
+                {
+                    word = stem(std::string_view(carry, n));
+                    co_yield word;
+                }
+            }
+            else if (n > 0 && n <= max_word)
+            {
+                word = stem(chunk.substr(start, n));
+                co_yield word;
+            }
+
+            while (i < chunk.size() && !alpha(chunk[i])) i++;
+        }
+    }
+
+    if (ncarry > 0 && !overlong)
+    {
+        word = stem(std::string_view(carry, ncarry));
+        co_yield word;
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+
+#include "porter.h"
+
+/* porterfts: an SQLite extension registering the FTS5 tokenizer "stemmer".
+ *
+ * Like FTS5's own porter tokenizer, it wraps another tokenizer, named by
+ * its first argument (unicode61, by default) and given the rest:
+ *
+ *   tokenize='stemmer'                          over unicode61
+ *   tokenize='stemmer unicode61 remove_diacritics 2'
+ *
+ * The tokenizer wrapped splits the text and folds its case (and, for
+ * unicode61, its diacritics, so "Café" and "CAFÉ" are both "cafe").  Each
+ * of its tokens which is a word of ASCII letters no longer than
+ * PORTER_MAXWORD is stemmed; the rest are passed on as they are.  Stems
+ * are reported in lower case, as FTS5's porter tokenizer reports them.
+ * Documents and queries go through the same function, so a query's terms
+ * always match the tokens indexed for the words they were stemmed from.
+ *
+ * Each connection which loads the extension gets its own stem cache, a
+ * direct-mapped table of recently stemmed words shared by every FTS5 table
+ * using the tokenizer on that connection.  A connection is only used by
+ * one thread at a time, so the cache needs no lock.
+ */
+
+#define PORTERFTS_SLOTS    16384   /* a power of 2 */
+#define PORTERFTS_PARENT   "unicode61"
+
+/* FNV-1a, which can be taken a byte at a time as words are scanned */
+#define PORTERFTS_FNV_BASIS  0xcbf29ce484222325ULL
+#define PORTERFTS_FNV_PRIME  0x100000001b3ULL
+
+typedef struct
+{
+    uint64_t hash;
+    uint8_t len;                    /* 0 if the slot is empty */
+    uint8_t stemlen;
+    char word[PORTER_MAXWORD + 1];
+    char stem[PORTER_MAXWORD + 1];
+} PORTERFTS_Slot;
+
+typedef struct
+{
+    PORTERFTS_Slot slots[PORTERFTS_SLOTS];
+} PORTERFTS_Cache;
+
+/* What the extension keeps for a connection: its FTS5 API, through which
+ * the tokenizers to be wrapped are found, and its stem cache. */
+typedef struct
+{
+    fts5_api *api;
+    PORTERFTS_Cache cache;
+} PORTERFTS_Module;
+
+typedef struct
+{
+    PORTERFTS_Cache *cache;
+    fts5_tokenizer parent;          /* the tokenizer wrapped */
+    Fts5Tokenizer *inner;           /* its instance */
+} PORTERFTS_Tokenizer;
+
+/* A call of xTokenize(), as its tokens come back from the parent. */
+typedef struct
+{
+    PORTERFTS_Cache *cache;
+    void *ctx;
+    int (*token)(void *, int, const char *, int, int, int);
+} PORTERFTS_Call;
+
+/* Stem a word (folded to lower case, and all letters) through the cache,
+ * returning its stem, which is held in the cache (so is only good until
+ * the next word).  The word's hash is taken as it is folded. */
+static const char *PORTERFTS_stem(PORTERFTS_Cache *cache, const char *word,
+                                  int len, uint64_t hash, int *stemlen)
+{
+    PORTERFTS_Slot *slot;
+    int n;
+
+    slot = &cache->slots[(hash ^ (hash >> 32)) & (PORTERFTS_SLOTS - 1)];
+
+    if (slot->hash != hash || slot->len != len ||
+        memcmp(slot->word, word, len) != 0)
+    {
+        memcpy(slot->stem, word, len);
+        slot->stem[len] = '\0';
+        PORTER_Stem(slot->stem);
+
+        for (n = 0; slot->stem[n] != '\0'; n++)
+        {
+            if (slot->stem[n] >= 'A' && slot->stem[n] <= 'Z')
+                slot->stem[n] += 'a' - 'A';
+        }
+
+        /* FTS5 has no use for an empty token ("s" has no stem) */
+        if (n == 0)
+        {
+            memcpy(slot->stem, word, len);
+            n = len;
+        }
+
+        slot->hash = hash;
+        slot->len = len;
+        slot->stemlen = n;
+        memcpy(slot->word, word, len);
+    }
+
+    *stemlen = slot->stemlen;
+    return slot->stem;
+}
+
+static int PORTERFTS_create(void *ctx, const char **argv, int argc,
+                             Fts5Tokenizer **out)
+{
+    PORTERFTS_Module *mod = ctx;
+    PORTERFTS_Tokenizer *tok;
+    const char *parent;
+    void *pctx;
+    int rc;
+
+    parent = PORTERFTS_PARENT;
+    if (argc > 0)
+    {
+        parent = argv[0];
+        argv++;
+        argc--;
+    }
+
+    tok = sqlite3_malloc(sizeof(*tok));
+    if (tok == NULL) return SQLITE_NOMEM;
+    memset(tok, 0x00, sizeof(*tok));
+    tok->cache = &mod->cache;
+
+    rc = mod->api->xFindTokenizer(mod->api, parent, &pctx, &tok->parent);
+    if (rc == SQLITE_OK)
+        rc = tok->parent.xCreate(pctx, argv, argc, &tok->inner);
+
+    if (rc != SQLITE_OK)
+    {
+        sqlite3_free(tok);
+        return rc;
+    }
+
+    *out = (Fts5Tokenizer *)tok;
+    return SQLITE_OK;
+}
+
+static void PORTERFTS_delete(Fts5Tokenizer *t)
+{
+    PORTERFTS_Tokenizer *tok = (PORTERFTS_Tokenizer *)t;
+
+    tok->parent.xDelete(tok->inner);
+    sqlite3_free(tok);
+
+    return;
+}
+
+/* Stem a token from the parent if it is a word of ASCII letters, folding
+ * it to lower case (which the parent will usually have done) and taking
+ * its hash as it is copied. */
+static int PORTERFTS_token(void *arg, int flags, const char *text, int len,
+                           int start, int end)
+{
+    PORTERFTS_Call *call = arg;
+    char word[PORTER_MAXWORD + 1];
+    const char *stem;
+    unsigned char c;
+    uint64_t hash;
+    int n;
+
+    if (len < 1 || len > PORTER_MAXWORD)
+        return call->token(call->ctx, flags, text, len, start, end);
+
+    hash = PORTERFTS_FNV_BASIS;
+    for (n = 0; n < len; n++)
+    {
+        c = text[n];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        else if (c < 'a' || c > 'z')
+            return call->token(call->ctx, flags, text, len, start, end);
+
+        word[n] = c;
+        hash = (hash ^ c) * PORTERFTS_FNV_PRIME;
+    }
+
+    stem = PORTERFTS_stem(call->cache, word, len, hash, &n);
+    return call->token(call->ctx, flags, stem, n, start, end);
+}
+
+static int PORTERFTS_tokenize(Fts5Tokenizer *t, void *ctx, int flags,
+                               const char *text, int len,
+                               int (*token)(void *, int, const char *, int,
+                                            int, int))
+{
+    PORTERFTS_Tokenizer *tok = (PORTERFTS_Tokenizer *)t;
+    PORTERFTS_Call call;
+
+    call.cache = tok->cache;
+    call.ctx = ctx;
+    call.token = token;
+
+    return tok->parent.xTokenize(tok->inner, &call, flags, text, len,
+                                 PORTERFTS_token);
+}
+
+/* Find the FTS5 API of a connection (NULL if FTS5 is not compiled in). */
+static fts5_api *PORTERFTS_api(sqlite3 *db)
+{
+    sqlite3_stmt *stmt;
+    fts5_api *api;
+
+    api = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT fts5(?1)", -1, &stmt, NULL)
+        != SQLITE_OK)
+        return NULL;
+
+    sqlite3_bind_pointer(stmt, 1, &api, "fts5_api_ptr", NULL);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    return api;
+}
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_porterfts_init(sqlite3 *db, char **err,
+                            const sqlite3_api_routines *routines)
+{
+    fts5_tokenizer tokenizer;
+    PORTERFTS_Module *mod;
+    fts5_api *api;
+    int rc;
+
+    SQLITE_EXTENSION_INIT2(routines);
+
+    api = PORTERFTS_api(db);
+    if (api == NULL || api->iVersion < 2)
+    {
+        *err = sqlite3_mprintf("porterfts: FTS5 is not available");
+        return SQLITE_ERROR;
+    }
+
+    /* the cache lives as long as the connection: FTS5 frees it (through
+     * sqlite3_free) when the tokenizer is unregistered at close */
+    mod = sqlite3_malloc(sizeof(*mod));
+    if (mod == NULL) return SQLITE_NOMEM;
+    memset(mod, 0x00, sizeof(*mod));
+    mod->api = api;
+
+    tokenizer.xCreate = PORTERFTS_create;
+    tokenizer.xDelete = PORTERFTS_delete;
+    tokenizer.xTokenize = PORTERFTS_tokenize;
+
+    rc = api->xCreateTokenizer(api, "stemmer", mod, &tokenizer,
+                               sqlite3_free);
+    if (rc != SQLITE_OK) sqlite3_free(mod);
+
+    return rc;
+}
@@ -0,0 +1,623 @@
+/* porter-prof: hardware performance counters for the stemming kernels.
+ *
+ * Each stemming path ("engine") is run over a corpus of one word per line
+ * and the counters are reported per 1000 words.  With -s, a single step
+ * function is isolated: the corpus is first carried through the preceding
+ * steps (uncounted), and only the named step is run under the counters.
+ *
+ * The step functions are private to porter.c, so it is included here
+ * rather than linked.  Counters come straight from perf_event_open(2); if
+ * none can be opened (no PMU, or perf_event_paranoid forbids it) only wall
+ * clock time is reported.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "porter.h"
+#include "porter.c"
+
+typedef struct
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+    uint64_t value;
+} PROF_Counter;
+
+static PROF_Counter PROF_counters[] =
+{
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1, 0 },
+    { "instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1, 0 },
+    { "branches", PERF_TYPE_HARDWARE,
+      PERF_COUNT_HW_BRANCH_INSTRUCTIONS, -1, 0 },
+    { "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1, 0 },
+    { "l1d-miss", PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), -1, 0 }
+};
+
+#define PROF_NCOUNTERS (sizeof(PROF_counters) / sizeof(PROF_counters[0]))
+
+/* The corpus is held as NUL-terminated words packed into an arena.  Engines
+ * stem a working copy in place, which is restored (uncounted) before each
+ * repetition. */
+typedef struct
+{
+    char *arena;
+    char *work;
+    size_t size;
+    size_t *off;
+    size_t *len;
+    char **words;        /* each word within work */
+    size_t n;
+} PROF_Corpus;
+
+/* For per-step runs, each word is kept with its measure map as it stands
+ * on entry to the step being profiled. */
+typedef struct
+{
+    char word[PORTER_MAXWORD + 2];
+    uint8_t map[PORTER_MAXWORD + 2];  /* from map[1]; map[0] is read */
+    int len;
+} PROF_State;
+
+typedef void (*PROF_Engine)(PROF_Corpus *c);
+
+static PORTER_Stopwords *PROF_stop;
+static PORTER_Cache *PROF_cache;
+
+static void PROF_engineStem(PROF_Corpus *c)
+{
+    size_t i;
+
+    for (i = 0; i < c->n; i++) PORTER_Stem(&c->work[c->off[i]]);
+    return;
+}
+
+static void PROF_engineS(PROF_Corpus *c)
+{
+    size_t i;
+
+    for (i = 0; i < c->n; i++) PORTER_StemS(&c->work[c->off[i]]);
+    return;
+}
+
+static void PROF_engineStep1(PROF_Corpus *c)
+{
+    size_t i;
+
+    for (i = 0; i < c->n; i++) PORTER_StemStep1(&c->work[c->off[i]]);
+    return;
+}
+
+static void PROF_engineStop(PROF_Corpus *c)
+{
+    size_t i;
+
+    for (i = 0; i < c->n; i++)
+        PORTER_StemStop(&c->work[c->off[i]], PROF_stop);
+    return;
+}
+
+static void PROF_engineCache(PROF_Corpus *c)
+{
+    size_t i;
+
+    for (i = 0; i < c->n; i++)
+        PORTER_StemCached(&c->work[c->off[i]], PROF_cache);
+    return;
+}
+
+/* Stem, then hash the stem: what PORTER_StemHash() saves a pass over. */
+static void PROF_engineStemThenHash(PROF_Corpus *c)
+{
+    volatile uint64_t sink;
+    char *w;
+    size_t i;
+
+    for (i = 0; i < c->n; i++)
+    {
+        w = &c->work[c->off[i]];
+        PORTER_Stem(w);
+        sink = PORTER_Hash(w, strlen(w), 0);
+    }
+
+    (void)sink;
+    return;
+}
+
+static void PROF_engineHash(PROF_Corpus *c)
+{
+    volatile uint64_t sink;
+    size_t i;
+
+    for (i = 0; i < c->n; i++)
+    {
+        sink = PORTER_StemHash(c->words[i], c->len[i], 0);
+    }
+
+    (void)sink;
+    return;
+}
+
+static void PROF_enginePatch(PROF_Corpus *c)
+{
+    static PORTER_Patch *patches;
+    static size_t n;
+
+    if (n < c->n)
+    {
+        free(patches);
+        patches = malloc(c->n * sizeof(*patches));
+        if (patches == NULL) return;
+        n = c->n;
+    }
+
+    PORTER_StemPatchBatch((const char *const *)c->words, c->len, c->n,
+                          patches);
+    return;
+}
+
+/* Does each word share a stem with the next?  First by stemming both and
+ * comparing, then with PORTER_SameStem(). */
+static void PROF_engineStemThenCompare(PROF_Corpus *c)
+{
+    volatile int sink;
+    char a[PORTER_MAXWORD + 1];
+    char b[PORTER_MAXWORD + 1];
+    size_t i;
+
+    for (i = 0; i + 1 < c->n; i++)
+    {
+        if (c->len[i] > PORTER_MAXWORD || c->len[i + 1] > PORTER_MAXWORD)
+            continue;
+
+        memcpy(a, &c->arena[c->off[i]], c->len[i] + 1);
+        memcpy(b, &c->arena[c->off[i + 1]], c->len[i + 1] + 1);
+        PORTER_Stem(a);
+        PORTER_Stem(b);
+        sink = (strcmp(a, b) == 0);
+    }
+
+    (void)sink;
+    return;
+}
+
+static void PROF_engineSame(PROF_Corpus *c)
+{
+    volatile int sink;
+    size_t i;
+
+    for (i = 0; i + 1 < c->n; i++)
+    {
+        if (c->len[i] > PORTER_MAXWORD || c->len[i + 1] > PORTER_MAXWORD)
+            continue;
+
+        sink = PORTER_SameStem(&c->arena[c->off[i]],
+                               &c->arena[c->off[i + 1]]);
+    }
+
+    (void)sink;
+    return;
+}
+
+static void PROF_engineBatch(PROF_Corpus *c)
+{
+    PORTER_StemBatch(c->words, c->n, 0);
+    return;
+}
+
+static void PROF_engineBucketed(PROF_Corpus *c)
+{
+    PORTER_StemBatch(c->words, c->n, PORTER_BATCH_BUCKET);
+    return;
+}
+
+static void PROF_engineSorted(PROF_Corpus *c)
+{
+    PORTER_StemSorted(c->words, c->n);
+    return;
+}
+
+static const struct
+{
+    const char *name;
+    PROF_Engine fn;
+} PROF_engines[] =
+{
+    { "stem", PROF_engineStem },
+    { "s", PROF_engineS },
+    { "step1", PROF_engineStep1 },
+    { "stop", PROF_engineStop },
+    { "sorted", PROF_engineSorted },
+    { "batch", PROF_engineBatch },
+    { "bucketed", PROF_engineBucketed },
+    { "stem+cmp", PROF_engineStemThenCompare },
+    { "same", PROF_engineSame },
+    { "cache", PROF_engineCache },
+    { "stem+hash", PROF_engineStemThenHash },
+    { "hash", PROF_engineHash },
+    { "patch", PROF_enginePatch }
+};
+
+#define PROF_NENGINES (sizeof(PROF_engines) / sizeof(PROF_engines[0]))
+
+typedef int (*PROF_Step)(char *word, int len, uint8_t *map);
+
+static const struct
+{
+    const char *name;
+    PROF_Step fn;
+} PROF_steps[] =
+{
+    { "1a", PORTER_step1a },
+    { "1b", PORTER_step1b },
+    { "1c", PORTER_step1c },
+    { "2", PORTER_step2 },
+    { "3", PORTER_step3 },
+    { "4", PORTER_step4 },
+    { "5a", PORTER_step5a },
+    { "5b", PORTER_step5b }
+};
+
+#define PROF_NSTEPS (sizeof(PROF_steps) / sizeof(PROF_steps[0]))
+
+static int PROF_openCounters(void)
+{
+    struct perf_event_attr attr;
+    size_t i;
+    int nopen;
+
+    nopen = 0;
+    for (i = 0; i < PROF_NCOUNTERS; i++)
+    {
+        memset(&attr, 0x00, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PROF_counters[i].type;
+        attr.config = PROF_counters[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        PROF_counters[i].fd = syscall(SYS_perf_event_open, &attr,
+                                      0, -1, -1, 0);
+        if (PROF_counters[i].fd >= 0) nopen++;
+    }
+
+    return nopen;
+}
+
+static void PROF_resetCounters(void)
+{
+    size_t i;
+
+    for (i = 0; i < PROF_NCOUNTERS; i++)
+    {
+        PROF_counters[i].value = 0;
+        if (PROF_counters[i].fd >= 0)
+            ioctl(PROF_counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+    }
+
+    return;
+}
+
+static void PROF_enableCounters(int on)
+{
+    size_t i;
+
+    for (i = 0; i < PROF_NCOUNTERS; i++)
+    {
+        if (PROF_counters[i].fd < 0) continue;
+        ioctl(PROF_counters[i].fd,
+              on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    return;
+}
+
+static void PROF_readCounters(void)
+{
+    size_t i;
+    uint64_t v;
+
+    for (i = 0; i < PROF_NCOUNTERS; i++)
+    {
+        if (PROF_counters[i].fd < 0) continue;
+        if (read(PROF_counters[i].fd, &v, sizeof(v)) == sizeof(v))
+            PROF_counters[i].value = v;
+    }
+
+    return;
+}
+
+static double PROF_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void PROF_header(void)
+{
+    size_t i;
+
+    fprintf(stdout, "%-12s %10s %9s", "path", "words", "ns/word");
+    for (i = 0; i < PROF_NCOUNTERS; i++)
+        fprintf(stdout, " %12s", PROF_counters[i].name);
+    fprintf(stdout, "\n");
+
+    return;
+}
+
+/* Print one row, with counters scaled to events per 1000 words. */
+static void PROF_report(const char *name, size_t words, double secs)
+{
+    size_t i;
+
+    fprintf(stdout, "%-12s %10zu %9.2f", name, words,
+            words ? secs * 1e9 / words : 0.0);
+
+    for (i = 0; i < PROF_NCOUNTERS; i++)
+    {
+        if (PROF_counters[i].fd < 0)
+            fprintf(stdout, " %12s", "n/a");
+        else
+            fprintf(stdout, " %12.1f",
+                    words ? PROF_counters[i].value * 1000.0 / words : 0.0);
+    }
+
+    fprintf(stdout, "\n");
+    return;
+}
+
+static int PROF_load(PROF_Corpus *c, const char *path)
+{
+    FILE *fp;
+    char line[4096];
+    size_t len;
+    size_t cap, ncap;
+    size_t i;
+    void *p;
+
+    fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    if (fp == NULL) return -1;
+
+    memset(c, 0x00, sizeof(*c));
+    cap = 0;
+    ncap = 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        len = strcspn(line, "\r\n");
+        if (len == 0) continue;
+
+        if (c->size + len + 1 > cap)
+        {
+            cap = (cap == 0) ? (1 << 20) : cap * 2;
+            if ((p = realloc(c->arena, cap)) == NULL) return -1;
+            c->arena = p;
+        }
+
+        if (c->n == ncap)
+        {
+            ncap = (ncap == 0) ? 65536 : ncap * 2;
+            if ((p = realloc(c->off, ncap * sizeof(*c->off))) == NULL)
+                return -1;
+            c->off = p;
+            if ((p = realloc(c->len, ncap * sizeof(*c->len))) == NULL)
+                return -1;
+            c->len = p;
+        }
+
+        c->len[c->n] = len;
+        c->off[c->n++] = c->size;
+        memcpy(&c->arena[c->size], line, len);
+        c->arena[c->size + len] = '\0';
+        c->size += len + 1;
+    }
+
+    if (fp != stdin) fclose(fp);
+
+    c->work = malloc(c->size + 1);
+    c->words = malloc((c->n + 1) * sizeof(*c->words));
+    if (c->work == NULL || c->words == NULL) return -1;
+
+    for (i = 0; i < c->n; i++) c->words[i] = &c->work[c->off[i]];
+
+    return 0;
+}
+
+static void PROF_runEngine(PROF_Corpus *c, size_t e, int reps)
+{
+    double secs;
+    double t;
+    int r;
+
+    PROF_resetCounters();
+    secs = 0.0;
+
+    for (r = 0; r < reps; r++)
+    {
+        memcpy(c->work, c->arena, c->size);
+
+        t = PROF_now();
+        PROF_enableCounters(1);
+        PROF_engines[e].fn(c);
+        PROF_enableCounters(0);
+        secs += PROF_now() - t;
+    }
+
+    PROF_readCounters();
+    PROF_report(PROF_engines[e].name, c->n * reps, secs);
+
+    return;
+}
+
+static int PROF_runStep(PROF_Corpus *c, size_t s, int reps)
+{
+    PROF_State *init;
+    PROF_State *work;
+    PROF_State *st;
+    PROF_Step fn;
+    char name[16];
+    double secs;
+    double t;
+    size_t n;
+    size_t i, j;
+    int r;
+
+    init = calloc(c->n, sizeof(*init));
+    work = calloc(c->n, sizeof(*work));
+    if (init == NULL || work == NULL)
+    {
+        free(init);
+        free(work);
+        return -1;
+    }
+
+    /* carry each word up to the entry of step s, as PORTER_Stem() would */
+    n = 0;
+    for (i = 0; i < c->n; i++)
+    {
+        st = &init[n];
+        st->len = strlen(&c->arena[c->off[i]]);
+        if (!PORTER_valid(&c->arena[c->off[i]], st->len)) continue;
+
+        memcpy(st->word, &c->arena[c->off[i]], st->len + 1);
+        PORTER_Measure(st->word, &st->map[1]);
+
+        for (j = 0; j < s; j++)
+            st->len = PROF_steps[j].fn(st->word, st->len, &st->map[1]);
+
+        n++;
+    }
+
+    fn = PROF_steps[s].fn;
+    PROF_resetCounters();
+    secs = 0.0;
+
+    for (r = 0; r < reps; r++)
+    {
+        memcpy(work, init, n * sizeof(*work));
+
+        t = PROF_now();
+        PROF_enableCounters(1);
+        for (i = 0; i < n; i++)
+            work[i].len = fn(work[i].word, work[i].len, &work[i].map[1]);
+        PROF_enableCounters(0);
+        secs += PROF_now() - t;
+    }
+
+    PROF_readCounters();
+    snprintf(name, sizeof(name), "step%s", PROF_steps[s].name);
+    PROF_report(name, n * reps, secs);
+
+    free(init);
+    free(work);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-r reps] [-e engine | -s step] corpus\n"
+            "\n"
+            "  -r reps    passes over the corpus (default 10)\n"
+            "  -e engine  profile only the named stemming path\n"
+            "  -s step    profile a single step (1a 1b 1c 2 3 4 5a 5b, or\n"
+            "             'all' for each in turn)\n"
+            "\n"
+            "Counters are reported per 1000 words.\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    PROF_Corpus corpus;
+    char name[64];
+    const char *engine;
+    const char *step;
+    size_t i;
+    int reps;
+    int opt;
+    int ran;
+
+    reps = 10;
+    engine = NULL;
+    step = NULL;
+
+    while ((opt = getopt(argc, argv, "r:e:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': reps = atoi(optarg); break;
+            case 'e': engine = optarg; break;
+            case 's': step = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || reps < 1 || (engine && step)) usage(argv[0]);
+
+    if (PROF_load(&corpus, argv[optind]) != 0)
+    {
+        fprintf(stderr, "%s: cannot load %s\n", argv[0], argv[optind]);
+        return 1;
+    }
+
+    PROF_stop = PORTER_StopwordsCreate(NULL, 0);
+
+    /* a private shared cache, gone as soon as it is closed */
+    snprintf(name, sizeof(name), "/porter-prof.%d", (int)getpid());
+    PROF_cache = PORTER_CacheOpen(name, 0);
+    PORTER_CacheUnlink(name);
+
+    if (PROF_openCounters() == 0)
+        fprintf(stderr, "%s: hardware counters unavailable (%s); "
+                "reporting wall clock only\n", argv[0], strerror(errno));
+
+    PROF_header();
+
+    ran = 0;
+    if (step != NULL)
+    {
+        for (i = 0; i < PROF_NSTEPS; i++)
+        {
+            if (strcmp(step, "all") != 0 && strcmp(step, PROF_steps[i].name))
+                continue;
+
+            if (PROF_runStep(&corpus, i, reps) == 0) ran++;
+        }
+    }
+    else
+    {
+        for (i = 0; i < PROF_NENGINES; i++)
+        {
+            if (engine != NULL && strcmp(engine, PROF_engines[i].name))
+                continue;
+
+            PROF_runEngine(&corpus, i, reps);
+            ran++;
+        }
+    }
+
+    if (ran == 0) usage(argv[0]);
+
+    PORTER_CacheClose(PROF_cache);
+    PORTER_StopwordsFree(PROF_stop);
+    return 0;
+}
@@ -0,0 +1,82 @@
+"""pybench: what stemming from Python costs, per word, by each route.
+
+The words (one per line) on standard input are stemmed by:
+
+  ctypes      PORTER_Stem() from libporter.so, one call per word
+  stem        porter.stem(), one call per word
+  batch       porter.stem_batch() on the list of words
+  buffer      porter.stem_buffer() on the words packed, Arrow-style
+
+Run it against the module built here (make all python), with the
+interpreter the module was built for:
+
+  PYTHONPATH=. python3 pybench.py [-r reps] [-t threads] < words
+"""
+
+import array
+import ctypes
+import getopt
+import sys
+import time
+
+import porter
+
+
+def best(reps, run):
+    times = []
+    for _ in range(reps):
+        t0 = time.perf_counter()
+        run()
+        times.append(time.perf_counter() - t0)
+    return min(times)
+
+
+def main():
+    reps = 3
+    threads = 0
+
+    opts, _ = getopt.getopt(sys.argv[1:], "r:t:")
+    for opt, arg in opts:
+        if opt == "-r":
+            reps = int(arg)
+        elif opt == "-t":
+            threads = int(arg)
+
+    words = sys.stdin.buffer.read().split(b"\n")
+    if words and words[-1] == b"":
+        words.pop()
+
+    data = b"".join(words)
+    offsets = array.array("q", [0])
+    for w in words:
+        offsets.append(offsets[-1] + len(w))
+
+    lib = ctypes.CDLL("./libporter.so")
+    lib.PORTER_Stem.argtypes = [ctypes.c_char_p]
+    buf = ctypes.create_string_buffer(32)
+
+    def by_ctypes():
+        for w in words:
+            if 0 < len(w) < 32:
+                buf.value = w
+                lib.PORTER_Stem(buf)
+
+    def by_stem():
+        for w in words:
+            porter.stem(w)
+
+    routes = [
+        ("ctypes", by_ctypes),
+        ("stem", by_stem),
+        ("batch", lambda: porter.stem_batch(words, threads)),
+        ("buffer", lambda: porter.stem_buffer(data, offsets, threads)),
+    ]
+
+    for name, run in routes:
+        t = best(reps, run)
+        print("%-8s %10d words %8.1f ns/word"
+              % (name, len(words), t * 1e9 / max(len(words), 1)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,478 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "porter.h"
+
+/* The Python module "porter": batches of words are stemmed in one call.
+ *
+ * A batch is held Arrow-style, as the words' bytes packed end to end and
+ * an array of n + 1 offsets (32- or 64-bit) where word i runs from
+ * offsets[i] to offsets[i + 1].  The words are copied into the result's
+ * buffer and stemmed there by a PORTER_Plan, with the GIL released; when
+ * the batch is large, threads started here claim its tasks in turn.  The
+ * plan packs the stems down and gives their offsets, which are then
+ * written out as wide as those given.  No Python object is made per word.
+ */
+
+#define PYPORTER_MINBATCH   65536   /* words a thread is worth starting for */
+#define PYPORTER_MAXTHREADS 64
+
+typedef struct
+{
+    const PORTER_Plan *plan;
+    size_t ntasks;
+    size_t next;               /* the next task to be claimed */
+} PYPORTER_Pool;
+
+static inline size_t PYPORTER_get(const void *offsets, int width, size_t i)
+{
+    if (width == 4) return ((const int32_t *)offsets)[i];
+    return ((const int64_t *)offsets)[i];
+}
+
+static inline void PYPORTER_set(void *offsets, int width, size_t i,
+                                size_t value)
+{
+    if (width == 4) ((int32_t *)offsets)[i] = value;
+    else ((int64_t *)offsets)[i] = value;
+    return;
+}
+
+/* Run a plan's tasks until none are left unclaimed. */
+static void *PYPORTER_run(void *arg)
+{
+    PYPORTER_Pool *pool = arg;
+    size_t task;
+
+    while ((task = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) <
+           pool->ntasks)
+        PORTER_PlanRun(pool->plan, task);
+
+    return NULL;
+}
+
+/* The number of threads to stem n words with, given the number asked for
+ * (0 to choose). */
+static int PYPORTER_threads(size_t n, int asked)
+{
+    long ncpu;
+    size_t t;
+
+    if (asked <= 0)
+    {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpu < 1) ncpu = 1;
+
+        t = n / PYPORTER_MINBATCH;
+        if (t > (size_t)ncpu) t = ncpu;
+    }
+    else
+    {
+        t = asked;
+        if (t > n) t = n;
+    }
+
+    if (t > PYPORTER_MAXTHREADS) t = PYPORTER_MAXTHREADS;
+    if (t < 1) t = 1;
+
+    return t;
+}
+
+/** Stem a batch (the GIL need not be held).
+ *
+ *  @param data      the words, which are stemmed in place.
+ *  @param in        the n + 1 offsets of the words in data, ascending.
+ *  @param out       the n + 1 offsets of the stems, once packed down.
+ *  @param nthreads  threads to use, the calling thread among them.
+ *  @return the length of the packed stems, or (size_t)-1 if the batch
+ *          could not be planned.
+ */
+static size_t PYPORTER_batch(char *data, const size_t *in, size_t *out,
+                             size_t n, int nthreads)
+{
+    PYPORTER_Pool pool;
+    pthread_t threads[PYPORTER_MAXTHREADS];
+    PORTER_Plan *plan;
+    size_t total;
+    int started;
+    int t;
+
+    plan = PORTER_PlanCreate(data, in, n, data, out, 0);
+    if (plan == NULL) return (size_t)-1;
+
+    pool.plan = plan;
+    pool.ntasks = PORTER_PlanTasks(plan);
+    pool.next = 0;
+
+    /* if a thread can't be started, the others take its share */
+    for (started = 1; started < nthreads; started++)
+    {
+        if ((size_t)started >= pool.ntasks ||
+            pthread_create(&threads[started], NULL, PYPORTER_run,
+                           &pool) != 0)
+            break;
+    }
+
+    PYPORTER_run(&pool);
+    for (t = 1; t < started; t++) pthread_join(threads[t], NULL);
+
+    total = PORTER_PlanFinish(plan);
+    PORTER_PlanFree(plan);
+
+    return total;
+}
+
+/* Wrap a stemmed batch's buffers as the (data, offsets) pair returned to
+ * Python, taking both references. */
+static PyObject *PYPORTER_result(PyObject *data, PyObject *offsets,
+                                 int width)
+{
+    PyObject *view;
+    PyObject *cast;
+
+    view = PyMemoryView_FromObject(offsets);
+    Py_DECREF(offsets);
+    if (view == NULL)
+    {
+        Py_DECREF(data);
+        return NULL;
+    }
+
+    cast = PyObject_CallMethod(view, "cast", "s", (width == 4) ? "i" : "q");
+    Py_DECREF(view);
+    if (cast == NULL)
+    {
+        Py_DECREF(data);
+        return NULL;
+    }
+
+    return Py_BuildValue("(NN)", data, cast);
+}
+
+/* The width of an offsets buffer's items, or 0 if it is not an array of
+ * 32- or 64-bit integers. */
+static int PYPORTER_width(const Py_buffer *buf)
+{
+    const char *fmt;
+
+    fmt = (buf->format != NULL) ? buf->format : "B";
+    if (*fmt == '@' || *fmt == '=' || *fmt == '<') fmt++;
+    if (strchr("iIlLqQ", *fmt) == NULL || fmt[1] != '\0') return 0;
+    if (buf->itemsize != 4 && buf->itemsize != 8) return 0;
+
+    return buf->itemsize;
+}
+
+PyDoc_STRVAR(PYPORTER_stem_doc,
+"stem(word) -> str or bytes\n\n"
+"Stem one word, returning the stem (in upper case, as PORTER_Stem()\n"
+"leaves it) as the same type as the word.  An empty word, or one of more\n"
+"than 31 bytes, is returned unchanged.");
+
+static PyObject *PYPORTER_Stem(PyObject *self, PyObject *arg)
+{
+    char word[PORTER_MAXWORD + 1];
+    const char *s;
+    Py_ssize_t len;
+
+    if (PyUnicode_Check(arg))
+    {
+        s = PyUnicode_AsUTF8AndSize(arg, &len);
+        if (s == NULL) return NULL;
+    }
+    else if (PyBytes_Check(arg))
+    {
+        s = PyBytes_AS_STRING(arg);
+        len = PyBytes_GET_SIZE(arg);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_TypeError, "stem() expects str or bytes");
+        return NULL;
+    }
+
+    if (len < 1 || len > PORTER_MAXWORD || memchr(s, '\0', len) != NULL)
+    {
+        Py_INCREF(arg);
+        return arg;
+    }
+
+    memcpy(word, s, len);
+    word[len] = '\0';
+    PORTER_Stem(word);
+
+    if (PyBytes_Check(arg)) return PyBytes_FromString(word);
+    return PyUnicode_DecodeUTF8(word, strlen(word), "surrogateescape");
+}
+
+PyDoc_STRVAR(PYPORTER_StemBatch_doc,
+"stem_batch(words, threads=0) -> (data, offsets)\n\n"
+"Stem a sequence of str or bytes in one call.  The stems come back\n"
+"packed, Arrow-style: data is a bytes object of the stems (str encoded\n"
+"as UTF-8) end to end, and offsets a memoryview of len(words) + 1 64-bit\n"
+"integers, stem i being data[offsets[i]:offsets[i + 1]].  threads is\n"
+"the number of threads to stem with; 0 chooses by the batch's size.");
+
+static PyObject *PYPORTER_StemBatch(PyObject *self, PyObject *args,
+                                    PyObject *kwargs)
+{
+    static char *kwlist[] = { "words", "threads", NULL };
+    PyObject *words;
+    PyObject *seq;
+    PyObject *item;
+    PyObject *data;
+    PyObject *offsets;
+    PyObject **items;
+    const char *s;
+    char *buf;
+    size_t *in;
+    size_t *out;
+    Py_ssize_t len;
+    Py_ssize_t n;
+    Py_ssize_t i;
+    size_t total;
+    int threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i", kwlist, &words,
+                                     &threads))
+        return NULL;
+
+    seq = PySequence_Fast(words, "stem_batch() expects a sequence");
+    if (seq == NULL) return NULL;
+
+    n = PySequence_Fast_GET_SIZE(seq);
+    items = PySequence_Fast_ITEMS(seq);
+
+    /* the words' offsets, then the stems' */
+    in = PyMem_Malloc(2 * (n + 1) * sizeof(*in));
+    if (in == NULL)
+    {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+
+    out = in + n + 1;
+
+    total = 0;
+    in[0] = 0;
+    for (i = 0; i < n; i++)
+    {
+        item = items[i];
+        if (PyUnicode_Check(item))
+        {
+            if (PyUnicode_AsUTF8AndSize(item, &len) == NULL) goto fail;
+        }
+        else if (PyBytes_Check(item))
+        {
+            len = PyBytes_GET_SIZE(item);
+        }
+        else
+        {
+            PyErr_Format(PyExc_TypeError,
+                         "stem_batch() expects str or bytes, not %.100s",
+                         Py_TYPE(item)->tp_name);
+            goto fail;
+        }
+
+        total += len;
+        in[i + 1] = total;
+    }
+
+    data = PyBytes_FromStringAndSize(NULL, total);
+    if (data == NULL) goto fail;
+
+    offsets = PyBytes_FromStringAndSize(NULL, (n + 1) * sizeof(int64_t));
+    if (offsets == NULL)
+    {
+        Py_DECREF(data);
+        goto fail;
+    }
+
+    /* the words are copied in while the sequence is safe from change */
+    buf = PyBytes_AS_STRING(data);
+    for (i = 0; i < n; i++)
+    {
+        item = items[i];
+        if (PyUnicode_Check(item)) s = PyUnicode_AsUTF8(item);
+        else s = PyBytes_AS_STRING(item);
+
+        memcpy(buf + in[i], s, in[i + 1] - in[i]);
+    }
+
+    Py_DECREF(seq);
+
+    Py_BEGIN_ALLOW_THREADS
+    total = PYPORTER_batch(buf, in, out, n, PYPORTER_threads(n, threads));
+    Py_END_ALLOW_THREADS
+
+    for (i = 0; total != (size_t)-1 && i <= n; i++)
+        PYPORTER_set(PyBytes_AS_STRING(offsets), 8, i, out[i]);
+
+    PyMem_Free(in);
+
+    if (total == (size_t)-1)
+    {
+        Py_DECREF(data);
+        Py_DECREF(offsets);
+        return PyErr_NoMemory();
+    }
+
+    if (_PyBytes_Resize(&data, total) != 0)
+    {
+        Py_DECREF(offsets);
+        return NULL;
+    }
+
+    return PYPORTER_result(data, offsets, 8);
+
+fail:
+    PyMem_Free(in);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+PyDoc_STRVAR(PYPORTER_StemBuffer_doc,
+"stem_buffer(data, offsets, threads=0) -> (data, offsets)\n\n"
+"Stem a batch held Arrow-style: data is any buffer of the words' bytes,\n"
+"and offsets any buffer of len + 1 32- or 64-bit integers (a NumPy\n"
+"array, or an Arrow array's buffers), word i being\n"
+"data[offsets[i]:offsets[i + 1]].  The stems come back in the same form,\n"
+"as a new bytes object and a memoryview of offsets as wide as those\n"
+"given, starting from 0.  Neither buffer may change during the call.");
+
+static PyObject *PYPORTER_StemBuffer(PyObject *self, PyObject *args,
+                                     PyObject *kwargs)
+{
+    static char *kwlist[] = { "data", "offsets", "threads", NULL };
+    Py_buffer words;
+    Py_buffer offs;
+    PyObject *obj;
+    PyObject *data;
+    PyObject *offsets;
+    size_t *in;
+    size_t *out;
+    size_t total;
+    size_t n;
+    size_t i;
+    int width;
+    int threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*O|i", kwlist, &words,
+                                     &obj, &threads))
+        return NULL;
+
+    if (PyObject_GetBuffer(obj, &offs,
+                           PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) != 0)
+    {
+        PyBuffer_Release(&words);
+        return NULL;
+    }
+
+    data = NULL;
+    in = NULL;
+    width = PYPORTER_width(&offs);
+    if (width == 0 || offs.len < width)
+    {
+        PyErr_SetString(PyExc_TypeError,
+                        "stem_buffer() expects offsets of 32- or 64-bit "
+                        "integers");
+        goto done;
+    }
+
+    n = offs.len / width - 1;
+
+    /* the words' offsets, then the stems' */
+    in = PyMem_Malloc(2 * (n + 1) * sizeof(*in));
+    if (in == NULL)
+    {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    out = in + n + 1;
+
+    in[0] = PYPORTER_get(offs.buf, width, 0);
+    for (i = 1; i <= n; i++)
+    {
+        in[i] = PYPORTER_get(offs.buf, width, i);
+        if (in[i] < in[i - 1]) break;
+    }
+
+    if (i <= n || in[n] > (size_t)words.len)
+    {
+        PyErr_SetString(PyExc_ValueError,
+                        "stem_buffer() offsets must ascend within data");
+        goto done;
+    }
+
+    data = PyBytes_FromStringAndSize(words.buf, words.len);
+    if (data == NULL) goto done;
+
+    offsets = PyBytes_FromStringAndSize(NULL, (n + 1) * width);
+    if (offsets == NULL)
+    {
+        Py_CLEAR(data);
+        goto done;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    total = PYPORTER_batch(PyBytes_AS_STRING(data), in, out, n,
+                           PYPORTER_threads(n, threads));
+    Py_END_ALLOW_THREADS
+
+    if (total == (size_t)-1)
+    {
+        Py_DECREF(offsets);
+        Py_CLEAR(data);
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (i = 0; i <= n; i++)
+        PYPORTER_set(PyBytes_AS_STRING(offsets), width, i, out[i]);
+
+    if (_PyBytes_Resize(&data, total) != 0)
+    {
+        Py_DECREF(offsets);
+        goto done;
+    }
+
+    data = PYPORTER_result(data, offsets, width);
+
+done:
+    PyMem_Free(in);
+    PyBuffer_Release(&words);
+    PyBuffer_Release(&offs);
+    return data;
+}
+
+static PyMethodDef PYPORTER_methods[] =
+{
+    { "stem", PYPORTER_Stem, METH_O, PYPORTER_stem_doc },
+    { "stem_batch", (PyCFunction)(void (*)(void))PYPORTER_StemBatch,
+      METH_VARARGS | METH_KEYWORDS, PYPORTER_StemBatch_doc },
+    { "stem_buffer", (PyCFunction)(void (*)(void))PYPORTER_StemBuffer,
+      METH_VARARGS | METH_KEYWORDS, PYPORTER_StemBuffer_doc },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef PYPORTER_module =
+{
+    PyModuleDef_HEAD_INIT,
+    "porter",
+    "The Porter stemmer, stemming batches of words in one call.",
+    -1,
+    PYPORTER_methods
+};
+
+PyMODINIT_FUNC PyInit_porter(void)
+{
+    return PyModule_Create(&PYPORTER_module);
+}
@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "porter.h"
+#include "record.h"
+
+/* Records are scanned in place: a record is located by its terminating
+ * newline, the selected field by walking separators, and only the words to
+ * be stemmed are ever copied (into a small scratch buffer, since
+ * PORTER_Stem() works on a mutable string).  Everything else is appended to
+ * the output buffer directly from the input block.
+ */
+
+int RECORD_Reserve(RECORD_Buffer *out, size_t len)
+{
+    char *p;
+    size_t cap;
+
+    if (out->len + len <= out->cap) return 0;
+
+    cap = (out->cap == 0) ? 65536 : out->cap;
+    while (cap < out->len + len) cap *= 2;
+
+    p = realloc(out->data, cap);
+    if (p == NULL) return -1;
+
+    out->data = p;
+    out->cap = cap;
+    return 0;
+}
+
+static int RECORD_append(RECORD_Buffer *out, const char *data, size_t len)
+{
+    if (out->discard) return 0;
+    if (RECORD_Reserve(out, len) != 0) return -1;
+
+    memcpy(&out->data[out->len], data, len);
+    out->len += len;
+    return 0;
+}
+
+/* Stem a word in place at the level the spec asks for. */
+static inline int RECORD_stem(const RECORD_Spec *spec, char *word)
+{
+    if (spec->level != 0 && spec->level != PORTER_LEVEL_FULL)
+        return PORTER_StemLevel(word, spec->level);
+    return PORTER_StemCached(word, spec->cache);
+}
+
+/* Stem a single word, appending the result.  Anything which isn't a word
+ * the stemmer will accept is appended unchanged. */
+static int RECORD_stemWord(const RECORD_Spec *spec, RECORD_Buffer *out,
+                           const char *word, size_t len)
+{
+    char tmp[PORTER_MAXWORD + 1];
+
+    if (!PORTER_IsWord(word, len)) return RECORD_append(out, word, len);
+
+    memcpy(tmp, word, len);
+    tmp[len] = '\0';
+
+    if (spec->stop != NULL && PORTER_IsStopword(spec->stop, tmp, len))
+        return RECORD_append(out, word, len);
+    if (RECORD_stem(spec, tmp) != 0)
+        return RECORD_append(out, word, len);
+
+    len = strlen(tmp);
+    if (out->sketch != NULL) PORTER_SketchAdd(out->sketch, tmp, len);
+    return RECORD_append(out, tmp, len);
+}
+
+/* Stem every alphabetic run within a span.  If 'json' is set, the span is
+ * the body of a JSON string and escape sequences are passed through. */
+static int RECORD_stemTokens(const RECORD_Spec *spec, RECORD_Buffer *out,
+                             const char *s, size_t len, int json)
+{
+    size_t i;
+    size_t start;
+
+    i = 0;
+    while (i < len)
+    {
+        start = i;
+
+        if (isalpha((unsigned char)s[i]))
+        {
+            while (i < len && isalpha((unsigned char)s[i])) i++;
+            if (RECORD_stemWord(spec, out, &s[start], i - start) != 0)
+                return -1;
+            continue;
+        }
+
+        while (i < len && !isalpha((unsigned char)s[i]))
+        {
+            if (json && s[i] == '\\' && i + 1 < len)
+            {
+                /* \uXXXX carries hex digits which must not be stemmed */
+                i += (s[i + 1] == 'u') ? 6 : 2;
+                if (i > len) i = len;
+                continue;
+            }
+
+            i++;
+        }
+
+        if (RECORD_append(out, &s[start], i - start) != 0) return -1;
+    }
+
+    return 0;
+}
+
+static int RECORD_stemField(const RECORD_Spec *spec, RECORD_Buffer *out,
+                            const char *s, size_t len, int json)
+{
+    if (spec->tokens) return RECORD_stemTokens(spec, out, s, len, json);
+    return RECORD_stemWord(spec, out, s, len);
+}
+
+/* Locate column spec->field of a TSV record.  Returns 0 if found. */
+static int RECORD_findTSV(const RECORD_Spec *spec, const char *rec,
+                          size_t len, size_t *fs, size_t *fe)
+{
+    size_t i;
+    int col;
+
+    col = 0;
+    *fs = 0;
+
+    for (i = 0; i < len; i++)
+    {
+        if (rec[i] != '\t') continue;
+
+        if (col == spec->field)
+        {
+            *fe = i;
+            return 0;
+        }
+
+        col++;
+        *fs = i + 1;
+    }
+
+    if (col != spec->field) return -1;
+
+    *fe = len;
+    return 0;
+}
+
+/* Locate column spec->field of a CSV record, excluding any surrounding
+ * quotes.  Returns 0 if found. */
+static int RECORD_findCSV(const RECORD_Spec *spec, const char *rec,
+                          size_t len, size_t *fs, size_t *fe)
+{
+    size_t i;
+    int col;
+    int quoted;
+
+    col = 0;
+    quoted = 0;
+    *fs = 0;
+
+    for (i = 0; i <= len; i++)
+    {
+        if (i < len && rec[i] == '"')
+        {
+            quoted = !quoted;
+            continue;
+        }
+
+        if (i < len && (quoted || rec[i] != ',')) continue;
+
+        if (col == spec->field)
+        {
+            *fe = i;
+
+            if (*fe - *fs >= 2 && rec[*fs] == '"' && rec[*fe - 1] == '"')
+            {
+                (*fs)++;
+                (*fe)--;
+            }
+
+            return 0;
+        }
+
+        col++;
+        *fs = i + 1;
+    }
+
+    return -1;
+}
+
+/* Skip a JSON string starting at the opening quote at rec[i].  Returns the
+ * offset of the closing quote (or len if the string is unterminated). */
+static size_t RECORD_skipString(const char *rec, size_t len, size_t i)
+{
+    for (i++; i < len; i++)
+    {
+        if (rec[i] == '\\') i++;
+        else if (rec[i] == '"') break;
+    }
+
+    return (i < len) ? i : len;
+}
+
+static size_t RECORD_skipSpace(const char *rec, size_t len, size_t i)
+{
+    while (i < len && isspace((unsigned char)rec[i])) i++;
+    return i;
+}
+
+/* Locate the string value of top-level member spec->key of a JSON object,
+ * excluding the quotes.  Returns 0 if found. */
+static int RECORD_findJSON(const RECORD_Spec *spec, const char *rec,
+                           size_t len, size_t *fs, size_t *fe)
+{
+    size_t i;
+    size_t end;
+    int depth;
+    int expectKey;
+
+    depth = 0;
+    expectKey = 0;
+
+    for (i = 0; i < len; i++)
+    {
+        switch (rec[i])
+        {
+            case '{': case '[':
+                depth++;
+                expectKey = (depth == 1 && rec[i] == '{');
+                break;
+
+            case '}': case ']':
+                depth--;
+                break;
+
+            case ',':
+                expectKey = (depth == 1);
+                break;
+
+            case '"':
+                end = RECORD_skipString(rec, len, i);
+                if (end == len) return -1;
+
+                if (expectKey && end - i - 1 == spec->keylen &&
+                    memcmp(&rec[i + 1], spec->key, spec->keylen) == 0)
+                {
+                    i = RECORD_skipSpace(rec, len, end + 1);
+                    if (i >= len || rec[i] != ':') return -1;
+
+                    i = RECORD_skipSpace(rec, len, i + 1);
+                    if (i >= len || rec[i] != '"') return -1;
+
+                    end = RECORD_skipString(rec, len, i);
+                    if (end == len) return -1;
+
+                    *fs = i + 1;
+                    *fe = end;
+                    return 0;
+                }
+
+                expectKey = 0;
+                i = end;
+                break;
+        }
+    }
+
+    return -1;
+}
+
+PORTER_Sketch **RECORD_Sketches(const RECORD_Spec *spec, size_t n)
+{
+    PORTER_Sketch **sketches;
+    size_t i;
+
+    if (spec->sketch == NULL) return NULL;
+
+    sketches = calloc(n, sizeof(*sketches));
+    if (sketches == NULL) return NULL;
+
+    for (i = 0; i < n; i++)
+    {
+        sketches[i] =
+            PORTER_SketchCreate(PORTER_SketchCapacity(spec->sketch));
+        if (sketches[i] == NULL)
+        {
+            while (i-- > 0) PORTER_SketchFree(sketches[i]);
+            free(sketches);
+            return NULL;
+        }
+    }
+
+    return sketches;
+}
+
+int RECORD_MergeSketches(const RECORD_Spec *spec, PORTER_Sketch **sketches,
+                         size_t n)
+{
+    size_t i;
+    int rc;
+
+    if (sketches == NULL) return 0;
+
+    rc = 0;
+    for (i = 0; i < n; i++)
+    {
+        if (PORTER_SketchMerge(spec->sketch, sketches[i]) != 0) rc = -1;
+        PORTER_SketchFree(sketches[i]);
+    }
+
+    free(sketches);
+    return rc;
+}
+
+size_t RECORD_Complete(const RECORD_Spec *spec, const char *buf, size_t len)
+{
+    size_t i;
+    size_t last;
+    int quoted;
+
+    if (spec->format != RECORD_CSV)
+    {
+        /* newlines can't appear within a TSV field or a JSON string */
+        for (i = len; i > 0; i--)
+        {
+            if (buf[i - 1] == '\n') return i;
+        }
+
+        return 0;
+    }
+
+    /* quoted CSV fields may contain newlines */
+    last = 0;
+    quoted = 0;
+    for (i = 0; i < len; i++)
+    {
+        if (buf[i] == '"') quoted = !quoted;
+        else if (buf[i] == '\n' && !quoted) last = i + 1;
+    }
+
+    return last;
+}
+
+/* Stem a block of one word per line.  Lines are taken whole (with any
+ * carriage return) and handed to the stemmer, which leaves anything it
+ * won't accept unchanged; stopwords are dropped, line and all.  Each line
+ * is given a newline, even the last. */
+static int RECORD_stemLines(const RECORD_Spec *spec, const char *buf,
+                            size_t len, RECORD_Buffer *out)
+{
+    char tmp[PORTER_MAXWORD + 1];
+    const char *nl;
+    size_t off;
+    size_t body;
+    size_t n;
+    int rc;
+    PORTER_Prefix prev;
+
+    memset(&prev, 0x00, sizeof(prev));
+
+    for (off = 0; off < len; off += body + 1)
+    {
+        nl = memchr(&buf[off], '\n', len - off);
+        body = (nl != NULL) ? (size_t)(nl - &buf[off]) : len - off;
+
+        if (body < 1 || body > PORTER_MAXWORD)
+        {
+            if (RECORD_append(out, &buf[off], body) != 0 ||
+                RECORD_append(out, "\n", 1) != 0)
+                return -1;
+            continue;
+        }
+
+        memcpy(tmp, &buf[off], body);
+        tmp[body] = '\0';
+        n = strlen(tmp);
+
+        if (spec->stop != NULL && PORTER_IsStopword(spec->stop, tmp, n))
+            continue;
+
+        if (spec->sorted) rc = PORTER_StemPrefix(tmp, &prev);
+        else rc = RECORD_stem(spec, tmp);
+        if (rc == 0)
+        {
+            n = strlen(tmp);
+            if (out->sketch != NULL) PORTER_SketchAdd(out->sketch, tmp, n);
+        }
+
+        if (out->discard) continue;
+        if (RECORD_Reserve(out, n + 1) != 0) return -1;
+        memcpy(&out->data[out->len], tmp, n);
+        out->data[out->len + n] = '\n';
+        out->len += n + 1;
+    }
+
+    return 0;
+}
+
+int RECORD_StemBlock(const RECORD_Spec *spec, const char *buf, size_t len,
+                     RECORD_Buffer *out)
+{
+    size_t off;
+    size_t end;
+    size_t body;
+    size_t fs, fe;
+    int found;
+    int quoted;
+
+    if (spec->format == RECORD_LINES)
+        return RECORD_stemLines(spec, buf, len, out);
+
+    off = 0;
+    while (off < len)
+    {
+        /* find the end of this record (including its newline) */
+        quoted = 0;
+        for (end = off; end < len; end++)
+        {
+            if (spec->format == RECORD_CSV && buf[end] == '"')
+                quoted = !quoted;
+            else if (buf[end] == '\n' && !quoted)
+                break;
+        }
+
+        if (end < len) end++;
+
+        /* the record body excludes the line terminator */
+        body = end - off;
+        if (body > 0 && buf[off + body - 1] == '\n') body--;
+        if (body > 0 && buf[off + body - 1] == '\r') body--;
+
+        switch (spec->format)
+        {
+            case RECORD_TSV:
+                found = RECORD_findTSV(spec, &buf[off], body, &fs, &fe);
+                break;
+
+            case RECORD_CSV:
+                found = RECORD_findCSV(spec, &buf[off], body, &fs, &fe);
+                break;
+
+            case RECORD_JSONL:
+                found = RECORD_findJSON(spec, &buf[off], body, &fs, &fe);
+                break;
+
+            default:
+                found = -1;
+                break;
+        }
+
+        if (found != 0)
+        {
+            /* no such field, so the whole record passes through */
+            if (RECORD_append(out, &buf[off], end - off) != 0) return -1;
+        }
+        else
+        {
+            if (RECORD_append(out, &buf[off], fs) != 0 ||
+                RECORD_stemField(spec, out, &buf[off + fs], fe - fs,
+                                 spec->format == RECORD_JSONL) != 0 ||
+                RECORD_append(out, &buf[off + fe], end - off - fe) != 0)
+                return -1;
+        }
+
+        off = end;
+    }
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stddef.h>
+
+#include "porter.h"
+
+/* Input formats understood by the record stemmer. */
+#define RECORD_TSV    1
+#define RECORD_CSV    2
+#define RECORD_JSONL  3
+#define RECORD_LINES  4
+
+/** Describes which part of each record is to be stemmed.
+ *
+ *  For TSV and CSV input, 'field' selects the (zero-based) column.  For
+ *  JSON-lines input, 'key' names a top-level member whose string value is
+ *  stemmed.  If 'tokens' is set, every alphabetic run within the field is
+ *  stemmed; otherwise the field is stemmed as a single word (and passed
+ *  through untouched if it is not one).  Stopwords found in 'stop' (if it
+ *  is not NULL) are passed through unstemmed.
+ *
+ *  RECORD_LINES is the plain input of one word per line, each of which is
+ *  stemmed (and stopwords dropped); if 'sorted' is set, the words are
+ *  stemmed with PORTER_StemPrefix().
+ *
+ *  If 'cache' is not NULL, stems are looked up in (and added to) it.
+ *
+ *  If 'sketch' is not NULL, the stems are also to be summarized in it.
+ *  Each thread stemming blocks counts into a sketch of its own (set in its
+ *  output buffer), and these are merged into 'sketch' once all are done.
+ *
+ *  'level' selects a lighter stemmer (PORTER_LEVEL_S or PORTER_LEVEL_STEP1)
+ *  in place of the full one; it can't be combined with 'sorted' or
+ *  'cache'.  Zero means PORTER_LEVEL_FULL.
+ */
+typedef struct
+{
+    int format;
+    int field;
+    const char *key;
+    size_t keylen;
+    int tokens;
+    int sorted;
+    const PORTER_Stopwords *stop;
+    PORTER_Cache *cache;
+    int level;
+    PORTER_Sketch *sketch;
+} RECORD_Spec;
+
+/** A growable output buffer, owned by the caller.  If 'sketch' is set,
+ *  every stem appended to the buffer is also added to it.  If 'discard' is
+ *  set, nothing is appended at all: the stems are only counted into the
+ *  sketch, for a caller with no output to write.
+ */
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+    PORTER_Sketch *sketch;
+    int discard;
+} RECORD_Buffer;
+
+/** Ensure there is room to append len bytes to a buffer.
+ *
+ *  @return 0 on success, -1 if memory could not be allocated.
+ */
+int RECORD_Reserve(RECORD_Buffer *out, size_t len);
+
+/** Create a sketch for each of n threads to count into, of the size of
+ *  the spec's sketch.
+ *
+ *  @return an array of n sketches, or NULL if the spec has no sketch or
+ *          memory could not be allocated.
+ */
+PORTER_Sketch **RECORD_Sketches(const RECORD_Spec *spec, size_t n);
+
+/** Merge the sketches made by RECORD_Sketches() into the spec's sketch, and
+ *  free them.
+ *
+ *  @return 0 on success, -1 if memory could not be allocated.
+ */
+int RECORD_MergeSketches(const RECORD_Spec *spec, PORTER_Sketch **sketches,
+                         size_t n);
+
+/** Find the end of the last complete record in a block.
+ *
+ *  @param spec  the record specification.
+ *  @param buf   the block, which must begin at the start of a record.
+ *  @param len   the number of bytes in the block.
+ *
+ *  @return the number of leading bytes of buf which make up complete
+ *          records (zero if no record is complete).
+ */
+size_t RECORD_Complete(const RECORD_Spec *spec, const char *buf, size_t len);
+
+/** Stem the selected field of every record in a block.
+ *
+ *  Fields are located in place; everything outside of the stemmed words is
+ *  copied to the output byte-for-byte.  The block must begin at the start
+ *  of a record.  A final record without a trailing newline is allowed.
+ *
+ *  @param spec  the record specification.
+ *  @param buf   the block of records.
+ *  @param len   the number of bytes in the block.
+ *  @param out   the buffer to which output is appended.
+ *
+ *  @return 0 on success, -1 if memory could not be allocated.
+ */
+int RECORD_StemBlock(const RECORD_Spec *spec, const char *buf, size_t len,
+                     RECORD_Buffer *out);
+
+#endif
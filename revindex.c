@@ -0,0 +1,508 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "porter.h"
+
+/* A reverse index maps each stem back to the surface forms which produced
+ * it.  On disk (and in memory, once mapped) it is laid out as:
+ *
+ *   header      PORTER_RevHeader
+ *   stems       nstems + 1 entries of { name, first }, sorted by name; the
+ *               forms of stem i are forms[stems[i].first .. stems[i+1].first)
+ *   forms       nforms pool offsets, sorted within each stem
+ *   pool        NUL-terminated strings (stems and forms)
+ *
+ * All offsets are relative to the start of the file, so a lookup is a
+ * binary search over the stem table and never allocates.
+ *
+ * Building is done in two passes: the words are split between threads,
+ * each of which stems and sorts its own share; the sorted runs are then
+ * merged (dropping duplicate forms) into the final tables.
+ */
+
+#define PORTER_REVMAGIC  "PORTRIX1"
+
+typedef struct
+{
+    char magic[8];
+    uint64_t nstems;
+    uint64_t nforms;
+    uint64_t stems;      /* file offset of the stem table */
+    uint64_t forms;      /* file offset of the form table */
+    uint64_t pool;       /* file offset of the string pool */
+    uint64_t poolsize;
+} PORTER_RevHeader;
+
+typedef struct
+{
+    uint64_t name;       /* file offset of the stem's string */
+    uint64_t first;      /* index of the stem's first form */
+} PORTER_RevStem;
+
+struct PORTER_RevIndex
+{
+    const uint8_t *base;
+    size_t size;
+    const PORTER_RevHeader *hdr;
+    const PORTER_RevStem *stems;
+    const uint64_t *forms;
+};
+
+/* One (stem, form) pair produced while building. */
+typedef struct
+{
+    char stem[PORTER_MAXWORD + 1];
+    const char *form;
+} PORTER_RevEntry;
+
+typedef struct
+{
+    const char *const *words;
+    size_t n;
+    PORTER_RevEntry *entries;
+    size_t nentries;
+} PORTER_RevRun;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} PORTER_RevVec;
+
+static int PORTER_cmpEntry(const void *a, const void *b)
+{
+    const PORTER_RevEntry *ea = a;
+    const PORTER_RevEntry *eb = b;
+    int rc;
+
+    rc = strcmp(ea->stem, eb->stem);
+    if (rc != 0) return rc;
+
+    return strcmp(ea->form, eb->form);
+}
+
+static void *PORTER_stemRun(void *arg)
+{
+    PORTER_RevRun *run = arg;
+    PORTER_RevEntry *e;
+    size_t len;
+    size_t i;
+
+    run->nentries = 0;
+    for (i = 0; i < run->n; i++)
+    {
+        len = strlen(run->words[i]);
+        if (len < 1 || len > PORTER_MAXWORD) continue;
+
+        e = &run->entries[run->nentries];
+        memcpy(e->stem, run->words[i], len + 1);
+        if (PORTER_Stem(e->stem) != 0) continue;
+
+        e->form = run->words[i];
+        run->nentries++;
+    }
+
+    qsort(run->entries, run->nentries, sizeof(*run->entries),
+          PORTER_cmpEntry);
+
+    return NULL;
+}
+
+static int PORTER_vecPut(PORTER_RevVec *v, const void *data, size_t len)
+{
+    uint8_t *p;
+    size_t cap;
+
+    if (v->len + len > v->cap)
+    {
+        cap = (v->cap == 0) ? 65536 : v->cap;
+        while (cap < v->len + len) cap *= 2;
+
+        p = realloc(v->data, cap);
+        if (p == NULL) return -1;
+
+        v->data = p;
+        v->cap = cap;
+    }
+
+    memcpy(&v->data[v->len], data, len);
+    v->len += len;
+    return 0;
+}
+
+/* The entry at the head of a run being merged. */
+static inline const PORTER_RevEntry *PORTER_runHead(const PORTER_RevRun *runs,
+                                                    const size_t *pos, int r)
+{
+    return &runs[r].entries[pos[r]];
+}
+
+/* Sift heap[i] down a binary min-heap of runs, ordered by their heads. */
+static void PORTER_heapDown(int *heap, int n, const PORTER_RevRun *runs,
+                            const size_t *pos, int i)
+{
+    int child;
+    int r;
+
+    r = heap[i];
+    for (;;)
+    {
+        child = 2 * i + 1;
+        if (child >= n) break;
+
+        if (child + 1 < n &&
+            PORTER_cmpEntry(PORTER_runHead(runs, pos, heap[child + 1]),
+                            PORTER_runHead(runs, pos, heap[child])) < 0)
+            child++;
+
+        if (PORTER_cmpEntry(PORTER_runHead(runs, pos, heap[child]),
+                            PORTER_runHead(runs, pos, r)) >= 0)
+            break;
+
+        heap[i] = heap[child];
+        i = child;
+    }
+
+    heap[i] = r;
+    return;
+}
+
+/* Merge the sorted runs into the stem table, form table and string pool.
+ * Pool offsets are recorded relative to the pool and fixed up on output.
+ * The runs are kept in a heap by their heads, so each entry costs
+ * O(log nruns) however many threads made runs. */
+static int PORTER_mergeRuns(PORTER_RevRun *runs, int nruns,
+                            PORTER_RevVec *stems, PORTER_RevVec *forms,
+                            PORTER_RevVec *pool)
+{
+    const PORTER_RevEntry *best;
+    const PORTER_RevEntry *prev;
+    PORTER_RevStem st;
+    size_t *pos;
+    int *heap;
+    uint64_t nforms;
+    uint64_t off;
+    int nheap;
+    int b;
+    int i;
+
+    pos = calloc(nruns, sizeof(*pos));
+    heap = malloc(nruns * sizeof(*heap));
+    if (pos == NULL || heap == NULL)
+    {
+        free(pos);
+        free(heap);
+        return -1;
+    }
+
+    nheap = 0;
+    for (i = 0; i < nruns; i++)
+    {
+        if (runs[i].nentries > 0) heap[nheap++] = i;
+    }
+
+    for (i = nheap / 2 - 1; i >= 0; i--)
+        PORTER_heapDown(heap, nheap, runs, pos, i);
+
+    prev = NULL;
+    nforms = 0;
+
+    while (nheap > 0)
+    {
+        b = heap[0];
+        best = PORTER_runHead(runs, pos, b);
+
+        /* move the run on, dropping it from the heap once it is done */
+        if (++pos[b] == runs[b].nentries) heap[0] = heap[--nheap];
+        if (nheap > 0) PORTER_heapDown(heap, nheap, runs, pos, 0);
+
+        if (prev != NULL && strcmp(prev->stem, best->stem) == 0)
+        {
+            if (strcmp(prev->form, best->form) == 0) continue;
+        }
+        else
+        {
+            st.name = pool->len;
+            st.first = nforms;
+            if (PORTER_vecPut(stems, &st, sizeof(st)) != 0 ||
+                PORTER_vecPut(pool, best->stem, strlen(best->stem) + 1) != 0)
+                goto fail;
+        }
+
+        off = pool->len;
+        if (PORTER_vecPut(forms, &off, sizeof(off)) != 0 ||
+            PORTER_vecPut(pool, best->form, strlen(best->form) + 1) != 0)
+            goto fail;
+
+        nforms++;
+        prev = best;
+    }
+
+    /* sentinel, so every stem's form count is first[i + 1] - first[i] */
+    st.name = 0;
+    st.first = nforms;
+    if (PORTER_vecPut(stems, &st, sizeof(st)) != 0) goto fail;
+
+    free(pos);
+    free(heap);
+    return 0;
+
+fail:
+    free(pos);
+    free(heap);
+    return -1;
+}
+
+static int PORTER_writeIndex(const char *path, PORTER_RevVec *stems,
+                             PORTER_RevVec *forms, PORTER_RevVec *pool)
+{
+    PORTER_RevHeader hdr;
+    PORTER_RevStem *st;
+    uint64_t *fo;
+    size_t i;
+    FILE *fp;
+    int rc;
+
+    memset(&hdr, 0x00, sizeof(hdr));
+    memcpy(hdr.magic, PORTER_REVMAGIC, sizeof(hdr.magic));
+    hdr.nstems = stems->len / sizeof(*st) - 1;
+    hdr.nforms = forms->len / sizeof(*fo);
+    hdr.stems = sizeof(hdr);
+    hdr.forms = hdr.stems + stems->len;
+    hdr.pool = hdr.forms + forms->len;
+    hdr.poolsize = pool->len;
+
+    /* make pool offsets relative to the file */
+    st = (PORTER_RevStem *)stems->data;
+    for (i = 0; i < hdr.nstems; i++) st[i].name += hdr.pool;
+
+    fo = (uint64_t *)forms->data;
+    for (i = 0; i < hdr.nforms; i++) fo[i] += hdr.pool;
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+
+    rc = 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(stems->data, 1, stems->len, fp) != stems->len ||
+        fwrite(forms->data, 1, forms->len, fp) != forms->len ||
+        fwrite(pool->data, 1, pool->len, fp) != pool->len)
+        rc = -1;
+
+    if (fclose(fp) != 0) rc = -1;
+    return rc;
+}
+
+int PORTER_RevIndexBuild(const char *const *words, size_t n, int nthreads,
+                         const char *path)
+{
+    PORTER_RevRun *runs;
+    pthread_t *tids;
+    PORTER_RevVec stems;
+    PORTER_RevVec forms;
+    PORTER_RevVec pool;
+    size_t per;
+    size_t off;
+    int started;
+    int rc;
+    int i;
+
+    if (nthreads < 1) nthreads = 1;
+    if ((size_t)nthreads > n) nthreads = (n > 0) ? n : 1;
+
+    runs = calloc(nthreads, sizeof(*runs));
+    tids = calloc(nthreads, sizeof(*tids));
+    if (runs == NULL || tids == NULL)
+    {
+        free(runs);
+        free(tids);
+        return -1;
+    }
+
+    memset(&stems, 0x00, sizeof(stems));
+    memset(&forms, 0x00, sizeof(forms));
+    memset(&pool, 0x00, sizeof(pool));
+    rc = -1;
+
+    per = (n + nthreads - 1) / nthreads;
+    off = 0;
+    for (i = 0; i < nthreads; i++)
+    {
+        runs[i].words = &words[off];
+        runs[i].n = (n - off < per) ? n - off : per;
+        runs[i].entries = malloc((runs[i].n + 1) * sizeof(*runs[i].entries));
+        if (runs[i].entries == NULL) goto done;
+        off += runs[i].n;
+    }
+
+    /* the calling thread takes the first run itself */
+    started = 1;
+    for (i = 1; i < nthreads; i++, started++)
+    {
+        if (pthread_create(&tids[i], NULL, PORTER_stemRun, &runs[i]) != 0)
+            break;
+    }
+
+    PORTER_stemRun(&runs[0]);
+    for (i = 1; i < started; i++) pthread_join(tids[i], NULL);
+
+    /* any run which couldn't be given a thread is done here */
+    for (i = started; i < nthreads; i++) PORTER_stemRun(&runs[i]);
+
+    if (PORTER_mergeRuns(runs, nthreads, &stems, &forms, &pool) == 0)
+        rc = PORTER_writeIndex(path, &stems, &forms, &pool);
+
+done:
+    for (i = 0; i < nthreads; i++) free(runs[i].entries);
+    free(runs);
+    free(tids);
+    free(stems.data);
+    free(forms.data);
+    free(pool.data);
+
+    return rc;
+}
+
+PORTER_RevIndex *PORTER_RevIndexOpen(const char *path)
+{
+    PORTER_RevIndex *ri;
+    const PORTER_RevHeader *hdr;
+    const PORTER_RevStem *stems;
+    const uint64_t *forms;
+    struct stat sb;
+    void *base;
+    uint64_t i;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(*hdr))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    /* check that the tables lie within the file before trusting them */
+    hdr = base;
+    if (memcmp(hdr->magic, PORTER_REVMAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->stems != sizeof(*hdr) ||
+        hdr->nstems >= ((uint64_t)sb.st_size - sizeof(*hdr)) /
+                       sizeof(PORTER_RevStem) ||
+        hdr->forms != hdr->stems +
+                      (hdr->nstems + 1) * sizeof(PORTER_RevStem) ||
+        hdr->nforms > ((uint64_t)sb.st_size - hdr->forms) /
+                      sizeof(uint64_t) ||
+        hdr->pool != hdr->forms + hdr->nforms * sizeof(uint64_t) ||
+        hdr->pool + hdr->poolsize != (uint64_t)sb.st_size ||
+        (hdr->poolsize > 0 && ((const char *)base)[sb.st_size - 1] != '\0'))
+        goto fail;
+
+    /* and that every string lies within the pool (which ends in a NUL, so
+     * each is terminated), and the stems' forms within the form table */
+    stems = (const PORTER_RevStem *)((const uint8_t *)base + hdr->stems);
+    forms = (const uint64_t *)((const uint8_t *)base + hdr->forms);
+
+    for (i = 0; i < hdr->nstems; i++)
+    {
+        if (stems[i].name < hdr->pool ||
+            stems[i].name >= (uint64_t)sb.st_size ||
+            stems[i].first > stems[i + 1].first)
+            goto fail;
+    }
+
+    if (stems[0].first != 0 || stems[hdr->nstems].first != hdr->nforms)
+        goto fail;
+
+    for (i = 0; i < hdr->nforms; i++)
+    {
+        if (forms[i] < hdr->pool || forms[i] >= (uint64_t)sb.st_size)
+            goto fail;
+    }
+
+    ri = malloc(sizeof(*ri));
+    if (ri == NULL) goto fail;
+
+    ri->base = base;
+    ri->size = sb.st_size;
+    ri->hdr = hdr;
+    ri->stems = stems;
+    ri->forms = forms;
+
+    return ri;
+
+fail:
+    munmap(base, sb.st_size);
+    return NULL;
+}
+
+void PORTER_RevIndexClose(PORTER_RevIndex *ri)
+{
+    if (ri == NULL) return;
+
+    munmap((void *)ri->base, ri->size);
+    free(ri);
+
+    return;
+}
+
+size_t PORTER_RevIndexLookup(const PORTER_RevIndex *ri, const char *stem,
+                             size_t len, const uint64_t **forms)
+{
+    const char *name;
+    size_t lo, hi, mid;
+    int rc;
+
+    lo = 0;
+    hi = ri->hdr->nstems;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        name = (const char *)ri->base + ri->stems[mid].name;
+
+        /* compare as strcmp() would, without needing stem terminated */
+        rc = strncmp(name, stem, len);
+        if (rc == 0 && name[len] != '\0') rc = 1;
+
+        if (rc == 0)
+        {
+            *forms = &ri->forms[ri->stems[mid].first];
+            return ri->stems[mid + 1].first - ri->stems[mid].first;
+        }
+
+        if (rc < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    *forms = NULL;
+    return 0;
+}
+
+const char *PORTER_RevIndexForm(const PORTER_RevIndex *ri, uint64_t form)
+{
+    return (const char *)ri->base + form;
+}
+
+size_t PORTER_RevIndexStems(const PORTER_RevIndex *ri)
+{
+    return ri->hdr->nstems;
+}
+
+size_t PORTER_RevIndexForms(const PORTER_RevIndex *ri)
+{
+    return ri->hdr->nforms;
+}
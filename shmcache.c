@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "porter.h"
+
+/* A stem cache shared between processes through a named shared memory
+ * segment.  The segment is a header followed by a fixed, power-of-two
+ * number of slots, each holding one word and its stem:
+ *
+ *   header      PORTER_CacheHeader
+ *   slots       nslots PORTER_CacheSlot
+ *
+ * A word may live in any of PORTER_CACHE_PROBE consecutive slots from the
+ * one its hash selects.  Each slot is guarded by a sequence number, which
+ * is odd while the slot is being written: a reader copies the slot out
+ * and only trusts the copy if the sequence number was even and unchanged
+ * throughout.  Readers never wait; a slot being written is simply a miss.
+ *
+ * A writer takes a slot by moving its sequence number from even to odd,
+ * with a compare-and-swap which also records the writer's pid alongside,
+ * so writers never share a slot.  If a writer dies mid-write, the slot
+ * would stay odd for good; a later writer finding the owner gone takes the
+ * slot over.  The owner may only look gone (its pid reused, or seen from
+ * another pid namespace) and still be writing, unseen by the sequence
+ * number, so each entry also carries a checksum of its hash, word and
+ * stem, and a reader only trusts a copy whose checksum holds.
+ *
+ * Hit and miss counts are kept in the handle and added to the shared
+ * counters every PORTER_CACHE_FLUSH lookups, rather than having every
+ * process write to the same cache line on every lookup.
+ */
+
+#define PORTER_CACHEMAGIC    "PORTSHC2"
+#define PORTER_CACHE_PROBE   4
+#define PORTER_CACHE_SLOTS   (1 << 16)
+#define PORTER_CACHE_FLUSH   4096
+
+typedef struct
+{
+    char magic[8];        /* written last, once the segment is ready */
+    uint64_t nslots;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t busy;
+    uint64_t recovered;
+} PORTER_CacheHeader;
+
+typedef struct
+{
+    uint64_t lock;        /* writer's pid << 32 | sequence number */
+    uint32_t hash;        /* the word's hash, or 0 if empty */
+    uint32_t check;       /* of hash, word and stem */
+    char word[PORTER_MAXWORD + 1];
+    char stem[PORTER_MAXWORD + 1];
+} PORTER_CacheSlot;
+
+struct PORTER_Cache
+{
+    PORTER_CacheHeader *hdr;
+    PORTER_CacheSlot *slots;
+    size_t size;
+    uint64_t mask;
+
+    /* counts not yet added to the header (the handle may be shared between
+     * threads, so these are atomic too, but uncontended between processes)
+     */
+    uint64_t pending;     /* lookups */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t busy;
+    uint64_t recovered;
+};
+
+static uint32_t PORTER_hashWord(const char *word, size_t len)
+{
+    uint32_t h;
+    size_t i;
+
+    for (h = 2166136261u, i = 0; i < len; i++)
+        h = (h ^ (uint8_t)word[i]) * 16777619u;
+
+    return (h == 0) ? 1 : h;
+}
+
+/* The checksum of an entry: its hash, word and stem (zero-padded). */
+static uint32_t PORTER_slotCheck(const PORTER_CacheSlot *s)
+{
+    uint64_t h;
+    uint64_t x;
+    size_t i;
+
+    h = 0x9e3779b97f4a7c15ULL ^ s->hash;
+    for (i = 0; i < sizeof(s->word); i += sizeof(x))
+    {
+        memcpy(&x, &s->word[i], sizeof(x));
+        h = (h ^ x) * 0x100000001b3ULL;
+        memcpy(&x, &s->stem[i], sizeof(x));
+        h = (h ^ x) * 0x100000001b3ULL;
+    }
+
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static size_t PORTER_cacheSize(uint64_t nslots)
+{
+    return sizeof(PORTER_CacheHeader) + nslots * sizeof(PORTER_CacheSlot);
+}
+
+/* Wait (briefly) for another process to finish creating the segment. */
+static int PORTER_waitReady(int fd, struct stat *sb)
+{
+    struct timespec ts;
+    char magic[8];
+    int i;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000;
+
+    for (i = 0; i < 1000; i++)
+    {
+        if (fstat(fd, sb) != 0) return -1;
+
+        if ((size_t)sb->st_size >= sizeof(PORTER_CacheHeader) &&
+            pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+            memcmp(magic, PORTER_CACHEMAGIC, sizeof(magic)) == 0)
+            return 0;
+
+        nanosleep(&ts, NULL);
+    }
+
+    return -1;
+}
+
+PORTER_Cache *PORTER_CacheOpen(const char *name, size_t slots)
+{
+    PORTER_Cache *c;
+    PORTER_CacheHeader *hdr;
+    struct stat sb;
+    uint64_t nslots;
+    size_t size;
+    void *base;
+    int created;
+    int fd;
+
+    nslots = PORTER_CACHE_PROBE;
+    if (slots == 0) slots = PORTER_CACHE_SLOTS;
+    while (nslots < slots) nslots *= 2;
+
+    created = 1;
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0);
+    }
+
+    if (fd < 0) return NULL;
+
+    if (created)
+    {
+        /* the zeroed segment is already an empty table */
+        size = PORTER_cacheSize(nslots);
+        if (ftruncate(fd, size) != 0)
+        {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    }
+    else
+    {
+        if (PORTER_waitReady(fd, &sb) != 0)
+        {
+            close(fd);
+            return NULL;
+        }
+        size = sb.st_size;
+    }
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    hdr = base;
+    if (created)
+    {
+        hdr->nslots = nslots;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(hdr->magic, PORTER_CACHEMAGIC, sizeof(hdr->magic));
+    }
+    else
+    {
+        /* the table's size is that of whoever created it */
+        nslots = hdr->nslots;
+        if (nslots < PORTER_CACHE_PROBE || (nslots & (nslots - 1)) != 0 ||
+            PORTER_cacheSize(nslots) != size)
+        {
+            munmap(base, size);
+            return NULL;
+        }
+    }
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL)
+    {
+        munmap(base, size);
+        return NULL;
+    }
+
+    c->hdr = hdr;
+    c->slots = (PORTER_CacheSlot *)(hdr + 1);
+    c->size = size;
+    c->mask = nslots - 1;
+
+    return c;
+}
+
+#define PORTER_count(c, counter) \
+    __atomic_fetch_add(&(c)->counter, 1, __ATOMIC_RELAXED)
+
+#define PORTER_flushCounter(c, counter) \
+    __atomic_fetch_add(&(c)->hdr->counter, \
+                       __atomic_exchange_n(&(c)->counter, 0, \
+                                           __ATOMIC_RELAXED), \
+                       __ATOMIC_RELAXED)
+
+static void PORTER_cacheFlush(PORTER_Cache *c)
+{
+    /* hits and misses are each counted as such: taking one from lookups
+     * could go below zero, with other threads counting between the two */
+    __atomic_store_n(&c->pending, 0, __ATOMIC_RELAXED);
+
+    PORTER_flushCounter(c, hits);
+    PORTER_flushCounter(c, misses);
+    PORTER_flushCounter(c, inserts);
+    PORTER_flushCounter(c, evictions);
+    PORTER_flushCounter(c, busy);
+    PORTER_flushCounter(c, recovered);
+
+    return;
+}
+
+void PORTER_CacheClose(PORTER_Cache *c)
+{
+    if (c == NULL) return;
+
+    PORTER_cacheFlush(c);
+    munmap(c->hdr, c->size);
+    free(c);
+
+    return;
+}
+
+int PORTER_CacheUnlink(const char *name)
+{
+    return shm_unlink(name);
+}
+
+/* Look for a word in its slots, copying its stem out if it is there. */
+static int PORTER_cacheFind(const PORTER_Cache *c, const char *word,
+                            size_t len, uint32_t hash, char *stem)
+{
+    const PORTER_CacheSlot *s;
+    PORTER_CacheSlot copy;
+    uint64_t lock;
+    int i;
+
+    for (i = 0; i < PORTER_CACHE_PROBE; i++)
+    {
+        s = &c->slots[(hash + i) & c->mask];
+
+        lock = __atomic_load_n(&s->lock, __ATOMIC_ACQUIRE);
+        if ((lock & 1) != 0 || s->hash != hash) continue;
+
+        memcpy(&copy, s, sizeof(copy));
+
+        /* only trust the copy if no writer touched the slot meanwhile, and
+         * it is whole (see above) */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->lock, __ATOMIC_RELAXED) != lock) continue;
+        if (copy.hash != hash || copy.check != PORTER_slotCheck(&copy))
+            continue;
+
+        if (memcmp(copy.word, word, len) != 0 || copy.word[len] != '\0')
+            continue;
+
+        copy.stem[PORTER_MAXWORD] = '\0';
+        strcpy(stem, copy.stem);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Take a slot for writing.  Returns the slot's new (odd) lock word, or 0 if
+ * another writer holds it. */
+static uint64_t PORTER_cacheTake(PORTER_Cache *c, PORTER_CacheSlot *s)
+{
+    uint64_t lock;
+    uint64_t next;
+    pid_t self;
+    pid_t owner;
+
+    /* not cached in the handle, which may have been inherited by fork() */
+    self = getpid();
+
+    lock = __atomic_load_n(&s->lock, __ATOMIC_RELAXED);
+    if ((lock & 1) != 0)
+    {
+        /* another writer has it, unless that writer has died */
+        owner = lock >> 32;
+        if (owner == self || kill(owner, 0) == 0 || errno != ESRCH)
+        {
+            PORTER_count(c, busy);
+            return 0;
+        }
+
+        PORTER_count(c, recovered);
+    }
+
+    /* odd either way; a changed value shuts out anyone else recovering */
+    next = ((uint64_t)self << 32) |
+           (uint32_t)(lock + ((lock & 1) ? 2 : 1));
+
+    if (!__atomic_compare_exchange_n(&s->lock, &lock, next, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        PORTER_count(c, busy);
+        return 0;
+    }
+
+    /* the odd sequence number must be seen before any of the new entry */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return next;
+}
+
+static void PORTER_cacheInsert(PORTER_Cache *c, const char *word,
+                               size_t len, uint32_t hash, const char *stem)
+{
+    PORTER_CacheSlot *s;
+    PORTER_CacheSlot *victim;
+    PORTER_CacheSlot entry;
+    uint64_t lock;
+    int i;
+
+    /* prefer an empty slot; otherwise evict one chosen by the hash */
+    victim = &c->slots[(hash + (hash >> 24) % PORTER_CACHE_PROBE) & c->mask];
+    for (i = 0; i < PORTER_CACHE_PROBE; i++)
+    {
+        s = &c->slots[(hash + i) & c->mask];
+        if (__atomic_load_n(&s->lock, __ATOMIC_RELAXED) == 0)
+        {
+            victim = s;
+            break;
+        }
+    }
+
+    /* the entry is made up (and its checksum taken) before the slot is
+     * taken, so that it is held no longer than the copy */
+    memset(&entry, 0x00, sizeof(entry));
+    entry.hash = hash;
+    memcpy(entry.word, word, len);
+    memcpy(entry.stem, stem, strlen(stem));
+    entry.check = PORTER_slotCheck(&entry);
+
+    lock = PORTER_cacheTake(c, victim);
+    if (lock == 0) return;
+
+    if (victim->hash != 0) PORTER_count(c, evictions);
+    PORTER_count(c, inserts);
+
+    victim->hash = entry.hash;
+    victim->check = entry.check;
+    memcpy(victim->word, entry.word, sizeof(entry.word));
+    memcpy(victim->stem, entry.stem, sizeof(entry.stem));
+
+    /* release only if the slot is still ours: if a writer has taken it
+     * over, having wrongly thought this process dead (its pid reused, or
+     * seen from another pid namespace), a plain store would publish their
+     * half-written entry.  The entry is dropped instead, and its checksum
+     * keeps readers from trusting any bytes written after the takeover. */
+    if (!__atomic_compare_exchange_n(&victim->lock, &lock, lock + 1, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        PORTER_count(c, busy);
+
+    return;
+}
+
+int PORTER_StemCached(char *word, PORTER_Cache *c)
+{
+    char raw[PORTER_MAXWORD + 1];
+    uint32_t hash;
+    size_t len;
+    int rc;
+
+    /* a word too long to stem is only read as far as it takes to know */
+    len = strnlen(word, PORTER_MAXWORD + 1);
+    if (c == NULL || len < 1 || len > PORTER_MAXWORD)
+        return PORTER_Stem(word);
+
+    if (PORTER_count(c, pending) + 1 >= PORTER_CACHE_FLUSH)
+        PORTER_cacheFlush(c);
+
+    hash = PORTER_hashWord(word, len);
+    if (PORTER_cacheFind(c, word, len, hash, word))
+    {
+        PORTER_count(c, hits);
+        return 0;
+    }
+
+    PORTER_count(c, misses);
+
+    memcpy(raw, word, len + 1);
+    rc = PORTER_Stem(word);
+    if (rc == 0) PORTER_cacheInsert(c, raw, len, hash, word);
+
+    return rc;
+}
+
+void PORTER_CacheStats(PORTER_Cache *c, PORTER_CacheCounts *counts)
+{
+    PORTER_CacheHeader *hdr = c->hdr;
+
+    PORTER_cacheFlush(c);
+
+    counts->slots = c->mask + 1;
+    counts->hits = __atomic_load_n(&hdr->hits, __ATOMIC_RELAXED);
+    counts->misses = __atomic_load_n(&hdr->misses, __ATOMIC_RELAXED);
+    counts->inserts = __atomic_load_n(&hdr->inserts, __ATOMIC_RELAXED);
+    counts->evictions = __atomic_load_n(&hdr->evictions, __ATOMIC_RELAXED);
+    counts->busy = __atomic_load_n(&hdr->busy, __ATOMIC_RELAXED);
+    counts->recovered = __atomic_load_n(&hdr->recovered, __ATOMIC_RELAXED);
+
+    return;
+}
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "porter.h"
+
+/* A sketch holds two summaries of the stems added to it, both fed from one
+ * hash of each stem:
+ *
+ *   distinct    a HyperLogLog counter of 2^14 one-byte registers: the top
+ *               14 bits of the hash pick a register, which keeps the
+ *               longest run of leading zeros seen in the remaining bits
+ *   frequent    a Space-Saving table of k counters.  A stem already held
+ *               has its counter bumped; otherwise the smallest counter is
+ *               taken over, and the new stem inherits its count (recorded
+ *               as the possible overcount, 'error')
+ *
+ * The counters are kept in a min-heap (so the smallest is always at the
+ * root) and found by stem through an open-addressed table of counter
+ * numbers, twice the size of the heap, with linear probing.
+ */
+
+#define PORTER_HLL_BITS  14
+#define PORTER_HLL_REGS  (1 << PORTER_HLL_BITS)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t error;
+    uint64_t hash;
+    uint32_t heap;       /* position within the heap */
+    uint8_t len;
+    char stem[PORTER_MAXWORD + 1];
+} PORTER_Counter;
+
+struct PORTER_Sketch
+{
+    size_t k;
+    size_t n;            /* counters in use */
+    uint64_t total;
+    PORTER_Counter *counters;
+    uint32_t *heap;      /* counter numbers, smallest count first */
+    uint32_t *table;     /* counter number + 1, or 0 if empty */
+    uint32_t mask;
+    uint8_t regs[PORTER_HLL_REGS];
+};
+
+PORTER_Sketch *PORTER_SketchCreate(size_t k)
+{
+    PORTER_Sketch *s;
+    size_t size;
+
+    if (k < 1 || k > (1 << 24)) return NULL;
+
+    for (size = 2; size < 2 * k; size <<= 1);
+
+    s = calloc(1, sizeof(*s));
+    if (s == NULL) return NULL;
+
+    s->k = k;
+    s->mask = size - 1;
+    s->counters = calloc(k, sizeof(*s->counters));
+    s->heap = calloc(k, sizeof(*s->heap));
+    s->table = calloc(size, sizeof(*s->table));
+
+    if (s->counters == NULL || s->heap == NULL || s->table == NULL)
+    {
+        PORTER_SketchFree(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+void PORTER_SketchFree(PORTER_Sketch *s)
+{
+    if (s == NULL) return;
+
+    free(s->counters);
+    free(s->heap);
+    free(s->table);
+    free(s);
+
+    return;
+}
+
+size_t PORTER_SketchCapacity(const PORTER_Sketch *s)
+{
+    return s->k;
+}
+
+static inline void PORTER_heapSet(PORTER_Sketch *s, uint32_t pos, uint32_t c)
+{
+    s->heap[pos] = c;
+    s->counters[c].heap = pos;
+    return;
+}
+
+static void PORTER_siftUp(PORTER_Sketch *s, uint32_t pos)
+{
+    uint32_t c;
+    uint32_t parent;
+
+    c = s->heap[pos];
+
+    while (pos > 0)
+    {
+        parent = (pos - 1) / 2;
+        if (s->counters[s->heap[parent]].count <= s->counters[c].count)
+            break;
+
+        PORTER_heapSet(s, pos, s->heap[parent]);
+        pos = parent;
+    }
+
+    PORTER_heapSet(s, pos, c);
+    return;
+}
+
+static void PORTER_siftDown(PORTER_Sketch *s, uint32_t pos)
+{
+    uint32_t c;
+    uint32_t child;
+    uint64_t count;
+
+    c = s->heap[pos];
+    count = s->counters[c].count;
+
+    for (;;)
+    {
+        child = 2 * pos + 1;
+        if (child >= s->n) break;
+
+        if (child + 1 < s->n &&
+            s->counters[s->heap[child + 1]].count <
+            s->counters[s->heap[child]].count)
+            child++;
+
+        if (count <= s->counters[s->heap[child]].count) break;
+
+        PORTER_heapSet(s, pos, s->heap[child]);
+        pos = child;
+    }
+
+    PORTER_heapSet(s, pos, c);
+    return;
+}
+
+/* Find the table slot holding a stem, or the empty slot ending its probe
+ * sequence. */
+static uint32_t PORTER_findSlot(const PORTER_Sketch *s, const char *stem,
+                                size_t len, uint64_t hash)
+{
+    const PORTER_Counter *ct;
+    uint32_t i;
+
+    for (i = hash & s->mask; s->table[i] != 0; i = (i + 1) & s->mask)
+    {
+        ct = &s->counters[s->table[i] - 1];
+        if (ct->hash == hash && ct->len == len &&
+            memcmp(ct->stem, stem, len) == 0)
+            break;
+    }
+
+    return i;
+}
+
+/* Empty a table slot, moving later entries of the probe sequence back so
+ * that none is cut off from its home slot. */
+static void PORTER_unslot(PORTER_Sketch *s, uint32_t i)
+{
+    uint32_t j;
+    uint32_t home;
+
+    for (j = (i + 1) & s->mask; s->table[j] != 0; j = (j + 1) & s->mask)
+    {
+        home = s->counters[s->table[j] - 1].hash & s->mask;
+
+        /* the entry at j may fill the hole at i only if its home slot is
+         * not (cyclically) between the two */
+        if (((j - home) & s->mask) >= ((j - i) & s->mask))
+        {
+            s->table[i] = s->table[j];
+            i = j;
+        }
+    }
+
+    s->table[i] = 0;
+    return;
+}
+
+static void PORTER_addHLL(PORTER_Sketch *s, uint64_t hash)
+{
+    uint32_t reg;
+    uint64_t rest;
+    uint8_t rank;
+
+    reg = hash >> (64 - PORTER_HLL_BITS);
+    rest = (hash << PORTER_HLL_BITS) | (1ULL << (PORTER_HLL_BITS - 1));
+    rank = __builtin_clzll(rest) + 1;
+
+    if (rank > s->regs[reg]) s->regs[reg] = rank;
+    return;
+}
+
+/* Count a stem known to hash to hash, weight times, with the given error;
+ * weight is 1 when adding, and anything when merging. */
+static void PORTER_count(PORTER_Sketch *s, const char *stem, size_t len,
+                         uint64_t hash, uint64_t weight, uint64_t error)
+{
+    PORTER_Counter *ct;
+    uint32_t i;
+    uint32_t c;
+
+    i = PORTER_findSlot(s, stem, len, hash);
+    if (s->table[i] != 0)
+    {
+        ct = &s->counters[s->table[i] - 1];
+        ct->count += weight;
+        ct->error += error;
+        PORTER_siftDown(s, ct->heap);
+        return;
+    }
+
+    if (s->n < s->k)
+    {
+        c = s->n++;
+        ct = &s->counters[c];
+        ct->count = 0;
+        ct->error = 0;
+        s->heap[c] = c;
+        ct->heap = c;
+    }
+    else
+    {
+        /* take over the smallest counter, whose count this stem may
+         * already have had */
+        c = s->heap[0];
+        ct = &s->counters[c];
+        PORTER_unslot(s, PORTER_findSlot(s, ct->stem, ct->len, ct->hash));
+        i = PORTER_findSlot(s, stem, len, hash);
+        ct->error = ct->count;
+    }
+
+    ct->count += weight;
+    ct->error += error;
+    ct->hash = hash;
+    ct->len = len;
+    memcpy(ct->stem, stem, len);
+    ct->stem[len] = '\0';
+    s->table[i] = c + 1;
+
+    PORTER_siftDown(s, ct->heap);
+    PORTER_siftUp(s, ct->heap);
+
+    return;
+}
+
+void PORTER_SketchAdd(PORTER_Sketch *s, const char *stem, size_t len)
+{
+    uint64_t hash;
+
+    if (len > PORTER_MAXWORD) len = PORTER_MAXWORD;
+
+    hash = PORTER_Hash(stem, len, 0);
+    PORTER_addHLL(s, hash);
+    PORTER_count(s, stem, len, hash, 1, 0);
+    s->total++;
+
+    return;
+}
+
+static int PORTER_byCount(const void *a, const void *b)
+{
+    const PORTER_Counter *x = a;
+    const PORTER_Counter *y = b;
+
+    if (x->count != y->count) return (x->count < y->count) ? 1 : -1;
+    return strcmp(x->stem, y->stem);
+}
+
+/* The count any stem not held by a full sketch may have had. */
+static inline uint64_t PORTER_floor(const PORTER_Sketch *s)
+{
+    return (s->n < s->k) ? 0 : s->counters[s->heap[0]].count;
+}
+
+int PORTER_SketchMerge(PORTER_Sketch *dst, const PORTER_Sketch *src)
+{
+    PORTER_Counter *all;
+    const PORTER_Counter *ct;
+    uint64_t dfloor;
+    uint64_t sfloor;
+    size_t n;
+    size_t i;
+    uint32_t slot;
+
+    if (dst->k != src->k) return -1;
+
+    for (i = 0; i < PORTER_HLL_REGS; i++)
+    {
+        if (src->regs[i] > dst->regs[i]) dst->regs[i] = src->regs[i];
+    }
+
+    /* each stem's count is its count in both summaries, taking a stem
+     * missing from one as having the smallest count held there (or none,
+     * if that one never filled up); the k largest are kept */
+    all = malloc((dst->n + src->n) * sizeof(*all) + 1);
+    if (all == NULL) return -1;
+
+    dfloor = PORTER_floor(dst);
+    sfloor = PORTER_floor(src);
+    n = 0;
+
+    for (i = 0; i < dst->n; i++)
+    {
+        ct = &dst->counters[i];
+        all[n] = *ct;
+
+        slot = PORTER_findSlot(src, ct->stem, ct->len, ct->hash);
+        if (src->table[slot] != 0)
+        {
+            all[n].count += src->counters[src->table[slot] - 1].count;
+            all[n].error += src->counters[src->table[slot] - 1].error;
+        }
+        else
+        {
+            all[n].count += sfloor;
+            all[n].error += sfloor;
+        }
+
+        n++;
+    }
+
+    for (i = 0; i < src->n; i++)
+    {
+        ct = &src->counters[i];
+        slot = PORTER_findSlot(dst, ct->stem, ct->len, ct->hash);
+        if (dst->table[slot] != 0) continue;
+
+        all[n] = *ct;
+        all[n].count += dfloor;
+        all[n].error += dfloor;
+        n++;
+    }
+
+    qsort(all, n, sizeof(*all), PORTER_byCount);
+    if (n > dst->k) n = dst->k;
+
+    memset(dst->table, 0x00, (dst->mask + 1) * sizeof(*dst->table));
+    dst->n = 0;
+    for (i = 0; i < n; i++)
+    {
+        PORTER_count(dst, all[i].stem, all[i].len, all[i].hash,
+                     all[i].count, all[i].error);
+    }
+
+    dst->total += src->total;
+
+    free(all);
+    return 0;
+}
+
+uint64_t PORTER_SketchTotal(const PORTER_Sketch *s)
+{
+    return s->total;
+}
+
+uint64_t PORTER_SketchDistinct(const PORTER_Sketch *s)
+{
+    double m;
+    double sum;
+    double estimate;
+    size_t zeros;
+    size_t i;
+
+    m = PORTER_HLL_REGS;
+    sum = 0.0;
+    zeros = 0;
+
+    for (i = 0; i < PORTER_HLL_REGS; i++)
+    {
+        sum += ldexp(1.0, -s->regs[i]);
+        if (s->regs[i] == 0) zeros++;
+    }
+
+    estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+
+    /* few registers are set while the count is small, where counting the
+     * empty ones (linear counting) is more accurate */
+    if (estimate <= 2.5 * m && zeros > 0)
+        estimate = m * log(m / zeros);
+
+    return (uint64_t)(estimate + 0.5);
+}
+
+size_t PORTER_SketchTop(const PORTER_Sketch *s, PORTER_TopStem *top,
+                        size_t n)
+{
+    PORTER_Counter *sorted;
+    size_t i;
+
+    sorted = malloc(s->n * sizeof(*sorted) + 1);
+    if (sorted == NULL) return 0;
+
+    memcpy(sorted, s->counters, s->n * sizeof(*sorted));
+    qsort(sorted, s->n, sizeof(*sorted), PORTER_byCount);
+
+    if (n > s->n) n = s->n;
+    for (i = 0; i < n; i++)
+    {
+        memcpy(top[i].stem, sorted[i].stem, sizeof(top[i].stem));
+        top[i].count = sorted[i].count;
+        top[i].error = sorted[i].error;
+    }
+
+    free(sorted);
+    return n;
+}
@@ -0,0 +1,694 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "record.h"
+#include "source.h"
+
+/* Input is taken from a mapping wherever possible, so that uncompressed
+ * data can be stemmed where it lies and compressed data can be split into
+ * members or frames and handed to separate threads.  Pipes are read as a
+ * stream, decompressing straight into the caller's buffer.
+ *
+ * Parallel gzip relies on the input being made of several members.  Where
+ * they carry their own length (BGZF, as written by bgzip) the members are
+ * found by walking the headers; otherwise the input is scanned for member
+ * headers, and since such a match may be a coincidence within compressed
+ * data, the real chain of members is only established as each is
+ * decompressed (see PARALLEL_Stem()).
+ */
+
+#define SOURCE_INSIZE (1 << 17)
+#define SOURCE_ZMAX   UINT_MAX    /* zlib counts bytes in an unsigned int */
+
+struct SOURCE_Input
+{
+    int fd;
+    int format;
+
+    /* a mapped input */
+    const uint8_t *map;
+    size_t size;
+
+    /* a streamed input */
+    uint8_t *in;
+    size_t inlen;         /* bytes of compressed input held in 'in' */
+    size_t inoff;         /* bytes of 'in' already consumed */
+    size_t mapoff;        /* streaming position within a mapping */
+    int eof;
+    int started;
+    int member;           /* part way through a gzip member */
+    int tty;              /* a terminal: read a line at a time */
+
+    z_stream zs;
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zd;
+#endif
+};
+
+static int SOURCE_detect(const uint8_t *p, size_t len)
+{
+    if (len >= 2 && p[0] == 0x1F && p[1] == 0x8B) return SOURCE_GZIP;
+    if (len >= 4 && p[0] == 0x28 && p[1] == 0xB5 &&
+        p[2] == 0x2F && p[3] == 0xFD)
+        return SOURCE_ZSTD;
+
+    return SOURCE_RAW;
+}
+
+SOURCE_Input *SOURCE_Open(const char *path)
+{
+    SOURCE_Input *in;
+    struct stat sb;
+    void *map;
+    ssize_t n;
+    int seekable;
+
+    in = calloc(1, sizeof(*in));
+    if (in == NULL) return NULL;
+
+    if (path == NULL || strcmp(path, "-") == 0) in->fd = STDIN_FILENO;
+    else in->fd = open(path, O_RDONLY);
+
+    if (in->fd < 0)
+    {
+        free(in);
+        return NULL;
+    }
+
+    if (fstat(in->fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0)
+    {
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+        if (map != MAP_FAILED)
+        {
+            madvise(map, sb.st_size, MADV_SEQUENTIAL);
+            in->map = map;
+            in->size = sb.st_size;
+            in->format = SOURCE_detect(in->map, in->size);
+        }
+    }
+
+    if (in->map == NULL)
+    {
+        in->in = malloc(SOURCE_INSIZE);
+        if (in->in == NULL)
+        {
+            SOURCE_Close(in);
+            return NULL;
+        }
+
+        /* a stream; read enough to recognise the format.  Nobody types
+         * compressed data, so a terminal isn't read until it is stemmed;
+         * other streams which can't be seeked (pipes, sockets) get one
+         * read, which must not wait for more than the writer has sent
+         * (compressors write their headers whole) */
+        in->tty = isatty(in->fd);
+        seekable = (lseek(in->fd, 0, SEEK_CUR) != (off_t)-1);
+        while (!in->tty && in->inlen < 4)
+        {
+            n = read(in->fd, &in->in[in->inlen], SOURCE_INSIZE - in->inlen);
+            if (n < 0)
+            {
+                SOURCE_Close(in);
+                return NULL;
+            }
+
+            if (n == 0)
+            {
+                in->eof = 1;
+                break;
+            }
+
+            in->inlen += n;
+            if (!seekable) break;
+        }
+
+        in->format = SOURCE_detect(in->in, in->inlen);
+    }
+
+#ifndef HAVE_ZSTD
+    if (in->format == SOURCE_ZSTD)
+    {
+        /* built without zstd; the input is not usable */
+        SOURCE_Close(in);
+        return NULL;
+    }
+#endif
+
+    return in;
+}
+
+void SOURCE_Close(SOURCE_Input *in)
+{
+    if (in == NULL) return;
+
+    if (in->started && in->format == SOURCE_GZIP) inflateEnd(&in->zs);
+#ifdef HAVE_ZSTD
+    if (in->zd != NULL) ZSTD_freeDCtx(in->zd);
+#endif
+
+    if (in->map != NULL) munmap((void *)in->map, in->size);
+    if (in->fd > STDIN_FILENO) close(in->fd);
+
+    free(in->in);
+    free(in);
+
+    return;
+}
+
+int SOURCE_Format(const SOURCE_Input *in)
+{
+    return in->format;
+}
+
+size_t SOURCE_Size(const SOURCE_Input *in)
+{
+    return in->size;
+}
+
+int SOURCE_Interactive(const SOURCE_Input *in)
+{
+    return in->tty;
+}
+
+int SOURCE_Ready(const SOURCE_Input *in)
+{
+    struct pollfd pfd;
+
+    if (in->map != NULL || in->eof || in->inoff < in->inlen) return 1;
+
+    pfd.fd = in->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/* Make compressed input available, from the mapping or from the stream.
+ * Returns the number of unconsumed bytes (0 at the end), or -1. */
+static ssize_t SOURCE_fill(SOURCE_Input *in, const uint8_t **p)
+{
+    ssize_t n;
+
+    if (in->map != NULL)
+    {
+        *p = &in->map[in->mapoff];
+        return in->size - in->mapoff;
+    }
+
+    if (in->inoff == in->inlen && !in->eof)
+    {
+        in->inoff = 0;
+        in->inlen = 0;
+
+        n = read(in->fd, in->in, SOURCE_INSIZE);
+        if (n < 0) return -1;
+        if (n == 0) in->eof = 1;
+        in->inlen = n;
+    }
+
+    *p = &in->in[in->inoff];
+    return in->inlen - in->inoff;
+}
+
+static void SOURCE_consume(SOURCE_Input *in, size_t n)
+{
+    if (in->map != NULL) in->mapoff += n;
+    else in->inoff += n;
+
+    return;
+}
+
+static ssize_t SOURCE_readGzip(SOURCE_Input *in, char *buf, size_t len)
+{
+    const uint8_t *p;
+    ssize_t avail;
+    size_t used;
+    int rc;
+
+    if (!in->started)
+    {
+        memset(&in->zs, 0x00, sizeof(in->zs));
+        if (inflateInit2(&in->zs, 16 + MAX_WBITS) != Z_OK) return -1;
+        in->started = 1;
+    }
+
+    if (len > SOURCE_ZMAX) len = SOURCE_ZMAX;
+
+    in->zs.next_out = (Bytef *)buf;
+    in->zs.avail_out = len;
+
+    while (in->zs.avail_out == len)
+    {
+        avail = SOURCE_fill(in, &p);
+        if (avail < 0) return -1;
+
+        /* the input may only end between members */
+        if (avail == 0)
+        {
+            if (in->member) return -1;
+            break;
+        }
+
+        if ((size_t)avail > SOURCE_ZMAX) avail = SOURCE_ZMAX;
+
+        in->zs.next_in = (Bytef *)p;
+        in->zs.avail_in = avail;
+
+        rc = inflate(&in->zs, Z_NO_FLUSH);
+        used = avail - in->zs.avail_in;
+        SOURCE_consume(in, used);
+
+        in->member = (rc != Z_STREAM_END);
+        if (rc == Z_STREAM_END)
+        {
+            /* members may follow one another */
+            inflateReset(&in->zs);
+            continue;
+        }
+
+        if (rc != Z_OK && rc != Z_BUF_ERROR) return -1;
+        if (rc == Z_BUF_ERROR && used == 0 && in->zs.avail_out == len)
+            return -1;
+    }
+
+    return len - in->zs.avail_out;
+}
+
+#ifdef HAVE_ZSTD
+static ssize_t SOURCE_readZstd(SOURCE_Input *in, char *buf, size_t len)
+{
+    ZSTD_inBuffer zin;
+    ZSTD_outBuffer zout;
+    const uint8_t *p;
+    ssize_t avail;
+    size_t rc;
+
+    if (in->zd == NULL)
+    {
+        in->zd = ZSTD_createDCtx();
+        if (in->zd == NULL) return -1;
+    }
+
+    zout.dst = buf;
+    zout.size = len;
+    zout.pos = 0;
+
+    while (zout.pos == 0)
+    {
+        avail = SOURCE_fill(in, &p);
+        if (avail < 0) return -1;
+        if (avail == 0) break;
+
+        zin.src = p;
+        zin.size = avail;
+        zin.pos = 0;
+
+        rc = ZSTD_decompressStream(in->zd, &zout, &zin);
+        SOURCE_consume(in, zin.pos);
+        if (ZSTD_isError(rc)) return -1;
+    }
+
+    return zout.pos;
+}
+#endif
+
+ssize_t SOURCE_Read(SOURCE_Input *in, char *buf, size_t len)
+{
+    const uint8_t *p;
+    ssize_t avail;
+
+    switch (in->format)
+    {
+        case SOURCE_GZIP:
+            return SOURCE_readGzip(in, buf, len);
+
+#ifdef HAVE_ZSTD
+        case SOURCE_ZSTD:
+            return SOURCE_readZstd(in, buf, len);
+#endif
+
+        case SOURCE_RAW:
+            avail = SOURCE_fill(in, &p);
+            if (avail <= 0) return avail;
+            if ((size_t)avail > len) avail = len;
+
+            memcpy(buf, p, avail);
+            SOURCE_consume(in, avail);
+            return avail;
+    }
+
+    return -1;
+}
+
+/* Parse the gzip member header at off.  Returns the member's length if it
+ * is a BGZF block (which records it), 0 if it is another plausible member
+ * header, or -1 if it isn't a member header at all. */
+static ssize_t SOURCE_gzipHeader(const uint8_t *p, size_t len)
+{
+    size_t xlen;
+    size_t i;
+
+    if (len < 18) return -1;
+    if (p[0] != 0x1F || p[1] != 0x8B || p[2] != 8) return -1;
+    if ((p[3] & 0xE0) != 0) return -1;                  /* reserved flags */
+    if (p[8] != 0 && p[8] != 2 && p[8] != 4) return -1; /* XFL */
+    if (p[9] > 13 && p[9] != 255) return -1;            /* OS */
+
+    if ((p[3] & 0x04) == 0) return 0;                   /* no FEXTRA */
+
+    xlen = p[10] | (p[11] << 8);
+    if (12 + xlen > len) return -1;
+
+    /* look for the BGZF "BC" subfield, holding the block size less one */
+    for (i = 12; i + 4 <= 12 + xlen; i += 4 + (p[i + 2] | (p[i + 3] << 8)))
+    {
+        if (p[i] == 'B' && p[i + 1] == 'C' && p[i + 2] == 2 && p[i + 3] == 0)
+        {
+            if (i + 6 > 12 + xlen) return -1;
+            return (p[i + 4] | (p[i + 5] << 8)) + 1;
+        }
+    }
+
+    return 0;
+}
+
+static SOURCE_Unit *SOURCE_addUnit(SOURCE_Unit *units, size_t *n,
+                                   size_t *cap, size_t off, size_t len)
+{
+    SOURCE_Unit *p;
+
+    if (*n == *cap)
+    {
+        *cap = (*cap == 0) ? 256 : *cap * 2;
+        p = realloc(units, *cap * sizeof(*units));
+        if (p == NULL)
+        {
+            free(units);
+            return NULL;
+        }
+        units = p;
+    }
+
+    units[*n].off = off;
+    units[*n].len = len;
+    (*n)++;
+
+    return units;
+}
+
+/* Members or frames of known length are gathered into units of roughly the
+ * preferred size; 'step' gives the length of the one at off (or 0 if the
+ * input can't be walked that way). */
+typedef size_t (*SOURCE_Step)(const uint8_t *p, size_t len);
+
+static size_t SOURCE_stepBGZF(const uint8_t *p, size_t len)
+{
+    ssize_t n;
+
+    n = SOURCE_gzipHeader(p, len);
+    if (n <= 0 || (size_t)n > len) return 0;
+    return n;
+}
+
+#ifdef HAVE_ZSTD
+static size_t SOURCE_stepZstd(const uint8_t *p, size_t len)
+{
+    size_t n;
+
+    n = ZSTD_findFrameCompressedSize(p, len);
+    if (ZSTD_isError(n) || n == 0 || n > len) return 0;
+    return n;
+}
+#endif
+
+static SOURCE_Unit *SOURCE_walk(SOURCE_Input *in, SOURCE_Step step,
+                                size_t size, size_t *n)
+{
+    SOURCE_Unit *units;
+    size_t cap;
+    size_t off;
+    size_t start;
+    size_t len;
+    size_t members;
+
+    units = NULL;
+    cap = 0;
+    *n = 0;
+
+    members = 0;
+    start = 0;
+    for (off = 0; off < in->size; off += len, members++)
+    {
+        len = step(&in->map[off], in->size - off);
+        if (len == 0)
+        {
+            free(units);
+            return NULL;
+        }
+
+        if (off + len - start >= size)
+        {
+            units = SOURCE_addUnit(units, n, &cap, start, off + len - start);
+            if (units == NULL) return NULL;
+            start = off + len;
+        }
+    }
+
+    if (start < in->size)
+    {
+        units = SOURCE_addUnit(units, n, &cap, start, in->size - start);
+        if (units == NULL) return NULL;
+    }
+
+    if (members < 2)
+    {
+        free(units);
+        return NULL;
+    }
+
+    return units;
+}
+
+/* Scan for anything that looks like the start of a gzip member. */
+static SOURCE_Unit *SOURCE_scanGzip(SOURCE_Input *in, size_t *n)
+{
+    SOURCE_Unit *units;
+    const uint8_t *p;
+    size_t cap;
+    size_t off;
+
+    units = NULL;
+    cap = 0;
+    *n = 0;
+
+    for (off = 0; off + 18 <= in->size; off = p - in->map + 1)
+    {
+        p = memchr(&in->map[off], 0x1F, in->size - off - 17);
+        if (p == NULL) break;
+
+        if (SOURCE_gzipHeader(p, in->size - (p - in->map)) < 0) continue;
+
+        units = SOURCE_addUnit(units, n, &cap, p - in->map, 0);
+        if (units == NULL) return NULL;
+    }
+
+    if (*n < 2 || units[0].off != 0)
+    {
+        free(units);
+        return NULL;
+    }
+
+    return units;
+}
+
+SOURCE_Unit *SOURCE_Units(SOURCE_Input *in, size_t size, size_t *n)
+{
+    SOURCE_Unit *units;
+    size_t cap;
+    size_t off;
+
+    if (in->map == NULL) return NULL;
+
+    switch (in->format)
+    {
+        case SOURCE_RAW:
+            units = NULL;
+            cap = 0;
+            *n = 0;
+            for (off = 0; off < in->size; off += size)
+            {
+                units = SOURCE_addUnit(units, n, &cap, off,
+                                       (in->size - off < size) ?
+                                       in->size - off : size);
+                if (units == NULL) return NULL;
+            }
+
+            return units;
+
+        case SOURCE_GZIP:
+            units = SOURCE_walk(in, SOURCE_stepBGZF, size, n);
+            if (units != NULL) return units;
+            return SOURCE_scanGzip(in, n);
+
+#ifdef HAVE_ZSTD
+        case SOURCE_ZSTD:
+            return SOURCE_walk(in, SOURCE_stepZstd, size, n);
+#endif
+    }
+
+    return NULL;
+}
+
+/* Inflate consecutive gzip members from off until limit (or, if limit is 0,
+ * a single member), appending to scratch. */
+static int SOURCE_decodeGzip(const SOURCE_Input *in, size_t off,
+                             size_t limit, RECORD_Buffer *scratch,
+                             size_t *end)
+{
+    z_stream zs;
+    size_t avail;
+    size_t left;
+    size_t chunk;
+    int rc;
+
+    avail = (limit ? limit : in->size) - off;
+
+    /* grow the output a chunk at a time (the buffer itself doubles) */
+    chunk = 2 * avail;
+    if (chunk < 65536) chunk = 65536;
+    if (chunk > SOURCE_INSIZE * 8) chunk = SOURCE_INSIZE * 8;
+
+    memset(&zs, 0x00, sizeof(zs));
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) return -1;
+
+    /* zlib is handed at most SOURCE_ZMAX bytes of input at a time */
+    zs.next_in = (Bytef *)&in->map[off];
+    left = avail;
+
+    for (;;)
+    {
+        if (RECORD_Reserve(scratch, chunk) != 0)
+        {
+            rc = Z_MEM_ERROR;
+            break;
+        }
+
+        if (zs.avail_in == 0)
+        {
+            zs.avail_in = (left > SOURCE_ZMAX) ? SOURCE_ZMAX : left;
+            left -= zs.avail_in;
+        }
+
+        zs.next_out = (Bytef *)&scratch->data[scratch->len];
+        zs.avail_out = (scratch->cap - scratch->len > SOURCE_ZMAX) ?
+                       SOURCE_ZMAX : scratch->cap - scratch->len;
+
+        rc = inflate(&zs, Z_NO_FLUSH);
+        scratch->len = zs.next_out - (Bytef *)scratch->data;
+
+        if (rc == Z_STREAM_END)
+        {
+            if (limit == 0 || (zs.avail_in == 0 && left == 0)) break;
+            inflateReset(&zs);
+            continue;
+        }
+
+        if (rc != Z_OK) break;
+    }
+
+    *end = off + avail - left - zs.avail_in;
+    inflateEnd(&zs);
+
+    return (rc == Z_STREAM_END) ? 0 : -1;
+}
+
+#ifdef HAVE_ZSTD
+static int SOURCE_decodeZstd(const SOURCE_Input *in, const SOURCE_Unit *u,
+                             RECORD_Buffer *scratch)
+{
+    ZSTD_DCtx *zd;
+    ZSTD_inBuffer zin;
+    ZSTD_outBuffer zout;
+    size_t rc;
+
+    zd = ZSTD_createDCtx();
+    if (zd == NULL) return -1;
+
+    zin.src = &in->map[u->off];
+    zin.size = u->len;
+    zin.pos = 0;
+    rc = 0;
+
+    while (zin.pos < zin.size)
+    {
+        if (RECORD_Reserve(scratch, 4 * u->len + 65536) != 0)
+        {
+            ZSTD_freeDCtx(zd);
+            return -1;
+        }
+
+        zout.dst = &scratch->data[scratch->len];
+        zout.size = scratch->cap - scratch->len;
+        zout.pos = 0;
+
+        rc = ZSTD_decompressStream(zd, &zout, &zin);
+        scratch->len += zout.pos;
+        if (ZSTD_isError(rc)) break;
+    }
+
+    ZSTD_freeDCtx(zd);
+    return ZSTD_isError(rc) ? -1 : 0;
+}
+#endif
+
+int SOURCE_Decode(const SOURCE_Input *in, const SOURCE_Unit *u,
+                  RECORD_Buffer *scratch, const char **data, size_t *len,
+                  size_t *end)
+{
+    int rc;
+
+    scratch->len = 0;
+
+    switch (in->format)
+    {
+        case SOURCE_RAW:
+            *data = (const char *)&in->map[u->off];
+            *len = u->len;
+            *end = u->off + u->len;
+            return 0;
+
+        case SOURCE_GZIP:
+            rc = SOURCE_decodeGzip(in, u->off, u->len ? u->off + u->len : 0,
+                                   scratch, end);
+            break;
+
+#ifdef HAVE_ZSTD
+        case SOURCE_ZSTD:
+            rc = SOURCE_decodeZstd(in, u, scratch);
+            *end = u->off + u->len;
+            break;
+#endif
+
+        default:
+            rc = -1;
+            break;
+    }
+
+    *data = scratch->data;
+    *len = scratch->len;
+
+    return rc;
+}
@@ -0,0 +1,84 @@
+#ifndef _SOURCE_H
+#define _SOURCE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "record.h"
+
+/* Input formats, detected from the first bytes of the input. */
+#define SOURCE_RAW   0
+#define SOURCE_GZIP  1
+#define SOURCE_ZSTD  2
+
+typedef struct SOURCE_Input SOURCE_Input;
+
+/** A piece of the input which can be decompressed on its own: a run of
+ *  gzip members or zstd frames, or a slice of uncompressed input.  If len
+ *  is 0, the extent is not known until the unit has been decompressed (a
+ *  gzip member found by scanning for its header, which may prove to be a
+ *  false match).
+ */
+typedef struct
+{
+    size_t off;
+    size_t len;
+} SOURCE_Unit;
+
+/** Open an input file ("-" or NULL for stdin).  Regular files are mapped;
+ *  anything else is read as a stream.
+ */
+SOURCE_Input *SOURCE_Open(const char *path);
+
+void SOURCE_Close(SOURCE_Input *in);
+
+int SOURCE_Format(const SOURCE_Input *in);
+
+/** The size of a mapped input (0 if the input is streamed). */
+size_t SOURCE_Size(const SOURCE_Input *in);
+
+/** Is the input a terminal, to be answered a line at a time? */
+int SOURCE_Interactive(const SOURCE_Input *in);
+
+/** Can more of a streamed input be read without waiting?  A reader which
+ *  has records in hand should hand them on, rather than wait, if not.
+ */
+int SOURCE_Ready(const SOURCE_Input *in);
+
+/** Read (and decompress) up to len bytes of the input as a stream.
+ *
+ *  @return the number of bytes read, 0 at the end of the input, or -1 on
+ *          error.
+ */
+ssize_t SOURCE_Read(SOURCE_Input *in, char *buf, size_t len);
+
+/** Split a mapped input into units for parallel decompression.
+ *
+ *  @param in    the input.
+ *  @param size  the preferred (compressed) size of each unit, where units
+ *               can be joined or split freely.
+ *  @param n     set to the number of units.
+ *
+ *  @return the units (to be freed by the caller), or NULL if the input
+ *          cannot be split (it isn't mapped, or is a single gzip member or
+ *          zstd frame).
+ */
+SOURCE_Unit *SOURCE_Units(SOURCE_Input *in, size_t size, size_t *n);
+
+/** Decompress one unit.  Uncompressed input is returned in place (no copy
+ *  is made); otherwise the data is decompressed into scratch.
+ *
+ *  @param in       the input.
+ *  @param u        the unit.
+ *  @param scratch  a buffer owned by the caller, reused between calls.
+ *  @param data     set to the unit's data.
+ *  @param len      set to the length of the unit's data.
+ *  @param end      set to the input offset just past the unit.
+ *
+ *  @return 0 on success, -1 if the unit could not be decompressed.
+ */
+int SOURCE_Decode(const SOURCE_Input *in, const SOURCE_Unit *u,
+                  RECORD_Buffer *scratch, const char **data, size_t *len,
+                  size_t *end);
+
+#endif
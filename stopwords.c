@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "porter.h"
+
+/* Stopwords are held in a perfect hash built by "hash and displace": each
+ * word is first hashed into one of a small number of buckets, then every
+ * bucket (largest first) is given a seed which places all of its words into
+ * distinct, empty slots of the table.  A lookup is therefore two hashes and
+ * a single comparison, regardless of the word.
+ *
+ * Words are stored uppercased (as PORTER_Stem() would leave them), and both
+ * hashing and comparison fold case, so a word can be checked before it has
+ * been touched by the stemmer.
+ */
+
+#define PORTER_MAXSEED (1 << 20)
+
+struct PORTER_Stopwords
+{
+    uint32_t nbuckets;
+    uint32_t mask;                     /* number of slots, less one */
+    uint32_t *seed;                    /* per-bucket displacement */
+    char (*slot)[PORTER_MAXWORD + 1];  /* "" marks an empty slot */
+};
+
+/* The English stopword list commonly used alongside the Porter stemmer. */
+static const char *PORTER_english[] =
+{
+    "A", "ABOUT", "ABOVE", "AFTER", "AGAIN", "AGAINST", "ALL", "AM", "AN",
+    "AND", "ANY", "ARE", "AS", "AT", "BE", "BECAUSE", "BEEN", "BEFORE",
+    "BEING", "BELOW", "BETWEEN", "BOTH", "BUT", "BY", "CAN", "DID", "DO",
+    "DOES", "DOING", "DON", "DOWN", "DURING", "EACH", "FEW", "FOR", "FROM",
+    "FURTHER", "HAD", "HAS", "HAVE", "HAVING", "HE", "HER", "HERE", "HERS",
+    "HERSELF", "HIM", "HIMSELF", "HIS", "HOW", "I", "IF", "IN", "INTO",
+    "IS", "IT", "ITS", "ITSELF", "JUST", "ME", "MORE", "MOST", "MY",
+    "MYSELF", "NO", "NOR", "NOT", "NOW", "OF", "OFF", "ON", "ONCE", "ONLY",
+    "OR", "OTHER", "OUR", "OURS", "OURSELVES", "OUT", "OVER", "OWN", "S",
+    "SAME", "SHE", "SHOULD", "SO", "SOME", "SUCH", "T", "THAN", "THAT",
+    "THE", "THEIR", "THEIRS", "THEM", "THEMSELVES", "THEN", "THERE",
+    "THESE", "THEY", "THIS", "THOSE", "THROUGH", "TO", "TOO", "UNDER",
+    "UNTIL", "UP", "VERY", "WAS", "WE", "WERE", "WHAT", "WHEN", "WHERE",
+    "WHICH", "WHILE", "WHO", "WHOM", "WHY", "WILL", "WITH", "WOULD", "YOU",
+    "YOUR", "YOURS", "YOURSELF", "YOURSELVES"
+};
+
+/* ASCII-only case folding; cheaper than toupper() and locale independent */
+static inline uint8_t PORTER_upper(char c)
+{
+    return (c >= 'a' && c <= 'z') ? (uint8_t)(c - 'a' + 'A') : (uint8_t)c;
+}
+
+static inline uint32_t PORTER_hashWord(const char *word, size_t len,
+                                       uint32_t seed)
+{
+    uint64_t h;
+    size_t i;
+
+    h = 0xCBF29CE484222325ULL ^ ((uint64_t)seed * 0x9E3779B97F4A7C15ULL);
+    for (i = 0; i < len; i++)
+    {
+        h ^= PORTER_upper(word[i]);
+        h *= 0x100000001B3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+
+    return (uint32_t)h;
+}
+
+/* Words are gathered as (string, length, bucket) while the table is being
+ * built. */
+typedef struct
+{
+    const char *word;
+    size_t len;
+    uint32_t bucket;
+} PORTER_Key;
+
+static int PORTER_cmpBucket(const void *a, const void *b)
+{
+    const PORTER_Key *ka = a;
+    const PORTER_Key *kb = b;
+
+    if (ka->bucket < kb->bucket) return -1;
+    if (ka->bucket > kb->bucket) return 1;
+    return 0;
+}
+
+static int PORTER_placeBucket(PORTER_Stopwords *sw, PORTER_Key *keys,
+                              size_t n)
+{
+    uint32_t seed;
+    uint32_t s;
+    size_t i, j;
+
+    for (seed = 1; seed < PORTER_MAXSEED; seed++)
+    {
+        for (i = 0; i < n; i++)
+        {
+            s = PORTER_hashWord(keys[i].word, keys[i].len, seed) & sw->mask;
+            if (sw->slot[s][0] != '\0') break;
+
+            /* claim it now; released below if the bucket doesn't fit */
+            for (j = 0; j < keys[i].len; j++)
+                sw->slot[s][j] = PORTER_upper(keys[i].word[j]);
+            sw->slot[s][j] = '\0';
+        }
+
+        if (i == n)
+        {
+            sw->seed[keys[0].bucket] = seed;
+            return 0;
+        }
+
+        while (i-- > 0)
+        {
+            s = PORTER_hashWord(keys[i].word, keys[i].len, seed) & sw->mask;
+            sw->slot[s][0] = '\0';
+        }
+    }
+
+    return -1;
+}
+
+typedef struct
+{
+    PORTER_Key *start;
+    size_t n;
+} PORTER_Bucket;
+
+static int PORTER_cmpSize(const void *a, const void *b)
+{
+    const PORTER_Bucket *ba = a;
+    const PORTER_Bucket *bb = b;
+
+    if (ba->n > bb->n) return -1;
+    if (ba->n < bb->n) return 1;
+    return 0;
+}
+
+PORTER_Stopwords *PORTER_StopwordsCreate(const char *const *words, size_t n)
+{
+    PORTER_Stopwords *sw;
+    PORTER_Key *keys;
+    PORTER_Bucket *buckets;
+    size_t nkeys;
+    size_t nslots;
+    size_t nb;
+    size_t len;
+    size_t i, j, k;
+
+    if (words == NULL)
+    {
+        words = PORTER_english;
+        n = sizeof(PORTER_english) / sizeof(PORTER_english[0]);
+    }
+
+    sw = calloc(1, sizeof(*sw));
+    keys = calloc(n + 1, sizeof(*keys));
+    if (sw == NULL || keys == NULL) goto fail;
+
+    /* keep at most half of the slots full, so seeds are quick to find */
+    nslots = 1;
+    while (nslots < 2 * n) nslots *= 2;
+
+    sw->nbuckets = (n / 2) + 1;
+    sw->mask = nslots - 1;
+    sw->seed = calloc(sw->nbuckets, sizeof(*sw->seed));
+    sw->slot = calloc(nslots, sizeof(*sw->slot));
+    buckets = calloc(sw->nbuckets, sizeof(*buckets));
+    if (sw->seed == NULL || sw->slot == NULL || buckets == NULL)
+    {
+        free(buckets);
+        goto fail;
+    }
+
+    nkeys = 0;
+    for (i = 0; i < n; i++)
+    {
+        len = strlen(words[i]);
+        if (len < 1 || len > PORTER_MAXWORD) continue;
+
+        keys[nkeys].word = words[i];
+        keys[nkeys].len = len;
+        keys[nkeys].bucket = PORTER_hashWord(words[i], len, 0) %
+                             sw->nbuckets;
+        nkeys++;
+    }
+
+    qsort(keys, nkeys, sizeof(*keys), PORTER_cmpBucket);
+
+    /* drop duplicates (which would never be placed) and gather buckets */
+    nb = 0;
+    for (i = 0; i < nkeys; i = j)
+    {
+        buckets[nb].start = &keys[i];
+        buckets[nb].n = 0;
+
+        for (j = i; j < nkeys && keys[j].bucket == keys[i].bucket; j++)
+        {
+            for (k = 0; k < buckets[nb].n; k++)
+            {
+                if (buckets[nb].start[k].len == keys[j].len &&
+                    strncasecmp(buckets[nb].start[k].word, keys[j].word,
+                                keys[j].len) == 0)
+                    break;
+            }
+
+            if (k == buckets[nb].n)
+                buckets[nb].start[buckets[nb].n++] = keys[j];
+        }
+
+        nb++;
+    }
+
+    qsort(buckets, nb, sizeof(*buckets), PORTER_cmpSize);
+
+    for (i = 0; i < nb; i++)
+    {
+        if (PORTER_placeBucket(sw, buckets[i].start, buckets[i].n) != 0)
+        {
+            free(buckets);
+            goto fail;
+        }
+    }
+
+    free(buckets);
+    free(keys);
+    return sw;
+
+fail:
+    free(keys);
+    PORTER_StopwordsFree(sw);
+    return NULL;
+}
+
+PORTER_Stopwords *PORTER_StopwordsLoad(const char *path)
+{
+    PORTER_Stopwords *sw;
+    FILE *fp;
+    char line[128];
+    char **words;
+    char **p;
+    size_t n;
+    size_t cap;
+    size_t len;
+    size_t i;
+    int c;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) return NULL;
+
+    words = NULL;
+    n = 0;
+    cap = 0;
+    sw = NULL;
+
+    /* one word per line; blank lines and '#' comments are ignored */
+    while (fgets(line, sizeof(line), fp))
+    {
+        /* the rest of a line too long for the buffer is not a new line */
+        if (strchr(line, '\n') == NULL)
+        {
+            while ((c = getc(fp)) != EOF && c != '\n') continue;
+        }
+
+        len = strcspn(line, " \t\r\n#");
+        if (len == 0) continue;
+
+        if (n == cap)
+        {
+            cap = (cap == 0) ? 256 : cap * 2;
+            p = realloc(words, cap * sizeof(*words));
+            if (p == NULL) goto done;
+            words = p;
+        }
+
+        words[n] = strndup(line, len);
+        if (words[n] == NULL) goto done;
+        n++;
+    }
+
+    if (!ferror(fp))
+        sw = PORTER_StopwordsCreate((const char *const *)words, n);
+
+done:
+    for (i = 0; i < n; i++) free(words[i]);
+    free(words);
+    fclose(fp);
+
+    return sw;
+}
+
+void PORTER_StopwordsFree(PORTER_Stopwords *sw)
+{
+    if (sw == NULL) return;
+
+    free(sw->seed);
+    free(sw->slot);
+    free(sw);
+
+    return;
+}
+
+int PORTER_IsStopword(const PORTER_Stopwords *sw, const char *word,
+                      size_t len)
+{
+    uint32_t b;
+    uint32_t s;
+    size_t i;
+
+    if (len < 1 || len > PORTER_MAXWORD) return 0;
+
+    b = PORTER_hashWord(word, len, 0) % sw->nbuckets;
+    s = PORTER_hashWord(word, len, sw->seed[b]) & sw->mask;
+
+    for (i = 0; i < len; i++)
+    {
+        if ((uint8_t)sw->slot[s][i] != PORTER_upper(word[i])) return 0;
+    }
+
+    return (sw->slot[s][len] == '\0');
+}
+
+int PORTER_StemStop(char *word, const PORTER_Stopwords *sw)
+{
+    size_t len;
+
+    /* neither a stopword nor stemmed; read no more of it than that needs */
+    len = strnlen(word, PORTER_MAXWORD + 1);
+    if (len > PORTER_MAXWORD) return -1;
+
+    if (sw != NULL && PORTER_IsStopword(sw, word, len))
+        return PORTER_STOPWORD;
+
+    return PORTER_Stem(word);
+}
@@ -0,0 +1,373 @@
+/* porter-stress: per-word latency of PORTER_Stem() under hostile input.
+ *
+ * The words (one per line) on standard input make the clean mix; the other
+ * mixes are made up from them and a fixed seed, the same number of words
+ * in each:
+ *
+ *   clean    the words, drawn at random
+ *   long     runs of letters from 1 KB to 64 KB
+ *   suffix   suffixes repeated over and over ("ATIONALATIONAL..."), half of
+ *            them short enough to stem and half up to 4 KB
+ *   garbage  1 to 64 random non-zero bytes
+ *   mixed    half clean words and a sixth from each of the others, shuffled
+ *
+ * Each word of a mix is timed on its own, a number of times over (-r), and
+ * the percentiles of all the times are reported.  Under hostile mixes the
+ * tail (p99.9, max) should be no worse than under clean text.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "porter.h"
+
+#define BENCH_RUNS     32      /* distinct long runs, shared by the words */
+#define BENCH_RUNMIN   1024
+#define BENCH_RUNMAX   65536
+#define BENCH_SUFMAX   4096
+
+typedef struct
+{
+    char *word;             /* stemmed in place */
+    const char *orig;       /* to put it back from */
+    size_t len;
+} BENCH_Word;
+
+typedef struct
+{
+    const char *name;
+    BENCH_Word *words;
+    size_t n;
+} BENCH_Mix;
+
+static const char *BENCH_suffixes[] =
+{
+    "ational", "ization", "iveness", "fulness", "ement", "ing", "ed",
+    "sses", "ies", "alli", "ousli", "icate"
+};
+
+#define BENCH_NSUFFIXES \
+    (sizeof(BENCH_suffixes) / sizeof(BENCH_suffixes[0]))
+
+static uint64_t BENCH_seed = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, so every run makes the same mixes */
+static uint64_t BENCH_random(void)
+{
+    BENCH_seed ^= BENCH_seed >> 12;
+    BENCH_seed ^= BENCH_seed << 25;
+    BENCH_seed ^= BENCH_seed >> 27;
+    return BENCH_seed * 0x2545f4914f6cdd1dULL;
+}
+
+static double BENCH_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+static void *BENCH_alloc(size_t size)
+{
+    void *p;
+
+    p = malloc(size);
+    if (p == NULL)
+    {
+        fprintf(stderr, "porter-stress: out of memory\n");
+        exit(1);
+    }
+
+    return p;
+}
+
+/* A word of a mix, with its own copy to stem.  Words too long to stem are
+ * never written to, so can share their bytes with other words. */
+static void BENCH_add(BENCH_Mix *mix, const char *w, size_t len)
+{
+    BENCH_Word *word = &mix->words[mix->n++];
+    char *copy;
+
+    word->orig = w;
+    word->len = len;
+
+    if (len > PORTER_MAXWORD)
+    {
+        word->word = (char *)w;
+        return;
+    }
+
+    copy = BENCH_alloc(len + 1);
+    memcpy(copy, w, len + 1);
+    word->word = copy;
+
+    return;
+}
+
+static void BENCH_start(BENCH_Mix *mix, const char *name, size_t n)
+{
+    mix->name = name;
+    mix->words = BENCH_alloc(n * sizeof(*mix->words));
+    mix->n = 0;
+
+    return;
+}
+
+static size_t BENCH_read(FILE *fp, char ***words)
+{
+    char line[256];
+    size_t size;
+    size_t n;
+    size_t len;
+
+    size = 1024;
+    n = 0;
+    *words = BENCH_alloc(size * sizeof(**words));
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        len = strcspn(line, "\r\n");
+        if (len == 0) continue;
+        line[len] = '\0';
+
+        if (n == size)
+        {
+            size *= 2;
+            *words = realloc(*words, size * sizeof(**words));
+            if (*words == NULL) return 0;
+        }
+
+        (*words)[n] = BENCH_alloc(len + 1);
+        memcpy((*words)[n], line, len + 1);
+        n++;
+    }
+
+    return n;
+}
+
+/* A terminated string of len bytes: the clean words run together. */
+static char *BENCH_run(char **clean, size_t nclean, size_t len)
+{
+    char *run;
+    size_t pos;
+    size_t k;
+
+    run = BENCH_alloc(len + 1);
+
+    for (pos = 0; pos < len; pos += k)
+    {
+        const char *w = clean[BENCH_random() % nclean];
+
+        k = strlen(w);
+        if (k > len - pos) k = len - pos;
+        memcpy(run + pos, w, k);
+    }
+
+    run[len] = '\0';
+    return run;
+}
+
+/* A suffix repeated to len bytes (cut short at the end, so that its tails
+ * are the suffix repeated from every phase). */
+static char *BENCH_repeat(const char *suffix, size_t len)
+{
+    char *word;
+    size_t slen;
+    size_t i;
+
+    word = BENCH_alloc(len + 1);
+    slen = strlen(suffix);
+
+    for (i = 0; i < len; i++) word[i] = suffix[i % slen];
+    word[len] = '\0';
+
+    return word;
+}
+
+static char *BENCH_garbage(size_t len)
+{
+    char *word;
+    size_t i;
+
+    word = BENCH_alloc(len + 1);
+    for (i = 0; i < len; i++) word[i] = 1 + BENCH_random() % 255;
+    word[len] = '\0';
+
+    return word;
+}
+
+static int BENCH_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double BENCH_percentile(const double *t, size_t n, double p)
+{
+    size_t i;
+
+    i = (size_t)(p * (n - 1) + 0.5);
+    return t[i];
+}
+
+/* Time every word of a mix reps times, and report the percentiles. */
+static void BENCH_time(const BENCH_Mix *mix, int reps, double *times)
+{
+    struct timespec t0, t1;
+    const BENCH_Word *w;
+    size_t k;
+    size_t i;
+    int r;
+
+    k = 0;
+    for (r = 0; r < reps; r++)
+    {
+        for (i = 0; i < mix->n; i++)
+        {
+            w = &mix->words[i];
+
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            PORTER_Stem(w->word);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+
+            times[k++] = BENCH_ns(&t0, &t1);
+
+            /* only words short enough to stem are ever changed */
+            if (w->len <= PORTER_MAXWORD)
+                memcpy(w->word, w->orig, w->len + 1);
+        }
+    }
+
+    qsort(times, k, sizeof(*times), BENCH_compare);
+
+    printf("%-8s %8zu words  p50 %6.0f  p99 %6.0f  p99.9 %6.0f  "
+           "max %8.0f ns\n", mix->name, mix->n,
+           BENCH_percentile(times, k, 0.5),
+           BENCH_percentile(times, k, 0.99),
+           BENCH_percentile(times, k, 0.999), times[k - 1]);
+
+    return;
+}
+
+static void BENCH_usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n words] [-r reps] < words\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    BENCH_Mix mixes[5];
+    BENCH_Word tmp;
+    char *runs[BENCH_RUNS];
+    char *repeats[BENCH_NSUFFIXES];
+    char **clean;
+    double *times;
+    size_t nclean;
+    size_t len;
+    size_t k;
+    size_t n = 100000;
+    size_t i;
+    size_t j;
+    int reps = 3;
+    int opt;
+    int m;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                n = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            default:
+                BENCH_usage(argv[0]);
+        }
+    }
+
+    if (n < 1 || reps < 1) BENCH_usage(argv[0]);
+
+    nclean = BENCH_read(stdin, &clean);
+    if (nclean == 0)
+    {
+        fprintf(stderr, "%s: no words\n", argv[0]);
+        return 1;
+    }
+
+    /* long runs of between 1 KB and 64 KB, spread evenly on a log scale */
+    for (i = 0; i < BENCH_RUNS; i++)
+    {
+        len = BENCH_RUNMIN;
+        for (j = 0; j < i * 6 / BENCH_RUNS; j++) len *= 2;
+        len += BENCH_random() % len;
+        if (len > BENCH_RUNMAX) len = BENCH_RUNMAX;
+        runs[i] = BENCH_run(clean, nclean, len);
+    }
+
+    /* the clean words in no order, as the others are */
+    BENCH_start(&mixes[0], "clean", n);
+    for (i = 0; i < n; i++)
+    {
+        j = BENCH_random() % nclean;
+        BENCH_add(&mixes[0], clean[j], strlen(clean[j]));
+    }
+
+    BENCH_start(&mixes[1], "long", n);
+    for (i = 0; i < n; i++)
+    {
+        j = BENCH_random() % BENCH_RUNS;
+        BENCH_add(&mixes[1], runs[j], strlen(runs[j]));
+    }
+
+    /* each suffix repeated once, as far as the longest word; the words
+     * are its last len bytes */
+    for (k = 0; k < BENCH_NSUFFIXES; k++)
+        repeats[k] = BENCH_repeat(BENCH_suffixes[k],
+                                  PORTER_MAXWORD + BENCH_SUFMAX);
+
+    BENCH_start(&mixes[2], "suffix", n);
+    for (i = 0; i < n; i++)
+    {
+        k = BENCH_random() % BENCH_NSUFFIXES;
+        if (i % 2 == 0) len = 1 + BENCH_random() % PORTER_MAXWORD;
+        else len = PORTER_MAXWORD + 1 + BENCH_random() % BENCH_SUFMAX;
+        BENCH_add(&mixes[2],
+                  repeats[k] + PORTER_MAXWORD + BENCH_SUFMAX - len, len);
+    }
+
+    BENCH_start(&mixes[3], "garbage", n);
+    for (i = 0; i < n; i++)
+    {
+        len = 1 + BENCH_random() % 64;
+        BENCH_add(&mixes[3], BENCH_garbage(len), len);
+    }
+
+    /* half clean, and a sixth from each of the others */
+    BENCH_start(&mixes[4], "mixed", n);
+    for (i = 0; i < n; i++)
+    {
+        m = (i % 2 == 0) ? 0 : 1 + (i / 2) % 3;
+        mixes[4].words[mixes[4].n++] = mixes[m].words[i];
+    }
+
+    for (i = n - 1; i > 0; i--)
+    {
+        j = BENCH_random() % (i + 1);
+        tmp = mixes[4].words[i];
+        mixes[4].words[i] = mixes[4].words[j];
+        mixes[4].words[j] = tmp;
+    }
+
+    times = BENCH_alloc(n * reps * sizeof(*times));
+
+    for (m = 0; m < 5; m++) BENCH_time(&mixes[m], reps, times);
+
+    return 0;
+}
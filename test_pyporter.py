@@ -0,0 +1,170 @@
+"""test_pyporter: the porter module checked against the porter CLI.
+
+A fixed set of words (real ones, made-up ones with common suffixes, and
+words the stemmer must pass through) is stemmed by the CLI, and every
+route through the module must give the same stems:
+
+  stem          one call per word, as bytes and as str
+  stem_batch    a list of bytes or str, on one thread and on several
+  stem_buffer   packed words with 32- and 64-bit offsets, whole or sliced,
+                on one thread and on several
+
+Offsets which descend or run outside the data must be refused.  Run by
+make python, or by hand against the module and CLI built here:
+
+  PYTHONPATH=. LD_LIBRARY_PATH=. python3 test_pyporter.py
+"""
+
+import array
+import os
+import random
+import subprocess
+import unittest
+
+import porter
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+WORDS = [
+    b"caresses", b"ponies", b"ties", b"caress", b"cats", b"feed",
+    b"agreed", b"plastered", b"motoring", b"sing", b"conflated",
+    b"troubled", b"sized", b"hopping", b"tanned", b"falling", b"hissing",
+    b"fizzed", b"failing", b"filing", b"happy", b"sky", b"relational",
+    b"conditional", b"rational", b"valenci", b"digitizer", b"operator",
+    b"generalization", b"generalizations", b"oscillators", b"RUNNING",
+    b"Measuring", b"a", b"", b"abc123", b"caf\xc3\xa9", b"don't",
+    b"supercalifragilisticexpialidocious",
+    b"abcdefghijklmnopqrstuvwxyzabcde", b"abcdefghijklmnopqrstuvwxyzabcdef",
+]
+
+SUFFIXES = [
+    b"", b"s", b"es", b"ies", b"sses", b"ed", b"ing", b"ly", b"ness",
+    b"ational", b"ization", b"iveness", b"fulness", b"ement", b"icate",
+]
+
+THREADS = (1, 4)
+
+
+def make_words(n, seed=1):
+    """The fixed words, then n made up from random letters and suffixes
+    (some too long to stem)."""
+    rng = random.Random(seed)
+    letters = b"abcdefghijklmnopqrstuvwxyz"
+    words = list(WORDS)
+
+    for _ in range(n):
+        stem = bytes(rng.choice(letters) for _ in range(rng.randint(1, 12)))
+        word = stem + rng.choice(SUFFIXES)
+        if rng.random() < 0.01:
+            word *= 4
+        words.append(word)
+
+    return words
+
+
+def cli_stems(words):
+    """The stems the CLI gives for words, one per line."""
+    env = dict(os.environ)
+    env["LD_LIBRARY_PATH"] = HERE
+    out = subprocess.run([os.path.join(HERE, "porter"), "-j", "1"],
+                         input=b"".join(w + b"\n" for w in words),
+                         stdout=subprocess.PIPE, env=env, check=True).stdout
+    stems = out.split(b"\n")
+    assert stems.pop() == b""
+    return stems
+
+
+def unpack(data, offsets):
+    return [data[offsets[i]:offsets[i + 1]] for i in range(len(offsets) - 1)]
+
+
+def pack(words, code):
+    data = b"".join(words)
+    offsets = array.array(code, [0])
+    for w in words:
+        offsets.append(offsets[-1] + len(w))
+    return data, offsets
+
+
+class TestPorter(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.words = make_words(200000)
+        cls.stems = cli_stems(cls.words)
+        assert len(cls.stems) == len(cls.words)
+
+    def test_stem_bytes(self):
+        for w, s in zip(self.words[:20000], self.stems):
+            self.assertEqual(porter.stem(w), s, w)
+
+    def test_stem_str(self):
+        for w, s in zip(self.words[:20000], self.stems):
+            self.assertEqual(porter.stem(w.decode()), s.decode(), w)
+
+    def test_stem_type(self):
+        self.assertRaises(TypeError, porter.stem, 42)
+
+    def test_batch_bytes(self):
+        for threads in THREADS:
+            data, offsets = porter.stem_batch(self.words, threads)
+            self.assertEqual(offsets.format, "q")
+            self.assertEqual(unpack(data, offsets), self.stems, threads)
+
+    def test_batch_str(self):
+        words = [w.decode() for w in self.words]
+        for threads in THREADS:
+            data, offsets = porter.stem_batch(words, threads=threads)
+            self.assertEqual(unpack(data, offsets), self.stems, threads)
+
+    def test_batch_empty(self):
+        data, offsets = porter.stem_batch([])
+        self.assertEqual((data, list(offsets)), (b"", [0]))
+
+    def test_batch_type(self):
+        self.assertRaises(TypeError, porter.stem_batch, [b"cats", 42])
+
+    def test_buffer(self):
+        for code in ("i", "q"):
+            data, offsets = pack(self.words, code)
+            for threads in THREADS:
+                out, offs = porter.stem_buffer(data, offsets, threads)
+                self.assertEqual(offs.format, code)
+                self.assertEqual(unpack(out, offs), self.stems,
+                                 (code, threads))
+
+    def test_buffer_sliced(self):
+        # a slice of a larger array, its offsets not starting from 0
+        first, last = 1234, 150000
+        for code in ("i", "q"):
+            data, offsets = pack(self.words, code)
+            view = memoryview(offsets)[first:last + 1]
+            for threads in THREADS:
+                out, offs = porter.stem_buffer(data, view, threads)
+                self.assertEqual(offs[0], 0)
+                self.assertEqual(unpack(out, offs), self.stems[first:last],
+                                 (code, threads))
+
+    def test_buffer_descending(self):
+        for code in ("i", "q"):
+            self.assertRaises(ValueError, porter.stem_buffer, b"catsdogs",
+                              array.array(code, [0, 4, 2, 8]))
+
+    def test_buffer_out_of_range(self):
+        for code in ("i", "q"):
+            self.assertRaises(ValueError, porter.stem_buffer, b"catsdogs",
+                              array.array(code, [0, 4, 9]))
+            self.assertRaises(ValueError, porter.stem_buffer, b"catsdogs",
+                              array.array(code, [-1, 4, 8]))
+            self.assertRaises(ValueError, porter.stem_buffer, b"catsdogs",
+                              array.array(code, [0, -4, 8]))
+
+    def test_buffer_type(self):
+        self.assertRaises(TypeError, porter.stem_buffer, b"catsdogs",
+                          array.array("d", [0, 4, 8]))
+        self.assertRaises(TypeError, porter.stem_buffer, b"catsdogs",
+                          array.array("h", [0, 4, 8]))
+
+
+if __name__ == "__main__":
+    unittest.main()